@@ -0,0 +1,298 @@
+// Runs every ROM of a corpus headless for a fixed number of frames with
+// scripted inputs, hashes each frame and the audio stream, and compares them
+// against the stored goldens. Reports throughput per ROM.
+//
+// The corpus file lists one ROM per line, paths relative to the corpus:
+//
+//     <rom> <frames> auto|fast|accurate [<input script>]
+//
+// The third column is the PPU render policy. An input script has one event
+// per line: `<frame> <button> down|up`, applied before that frame runs.
+// Goldens are stored next to the ROM as <rom>.golden for auto and
+// <rom>.<policy>.golden otherwise, one `<frame hash> <audio hash>` line per
+// frame. `--record` rewrites them.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "AudioSink.hpp"
+#include "Emulator.hpp"
+#include "FrameSink.hpp"
+#include "XXHash64.hpp"
+
+using namespace GB;
+
+static const usize FRAME_BYTES = SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(u32);
+
+struct InputEvent {
+    u64 frame;
+    Joypad::Buttons::Button button;
+    bool pressed;
+};
+
+struct FrameHashes {
+    u64 video;
+    u64 audio;
+};
+
+// Chains the hash over every block of samples, at a fixed rate
+class HashAudioSink : public AudioSink {
+    public:
+        double sample_rate() const override { return 44100.0; }
+        void write(const i16* samples, usize length) override
+        {
+            m_hash = XXHash64::hash(samples, length * sizeof(i16), m_hash);
+        }
+
+        inline u64 hash() const { return m_hash; }
+
+    private:
+        u64 m_hash { 0 };
+};
+
+struct Entry {
+    std::string rom;
+    u64 frames;
+    PPU::RenderPolicy::Policy policy;
+    std::string policy_name;
+    std::vector<InputEvent> inputs;
+};
+
+static std::string directory_of(const std::string& path)
+{
+    auto slash = path.find_last_of('/');
+    return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+}
+
+static bool parse_button(const std::string& name, Joypad::Buttons::Button& button)
+{
+    static const struct {
+        const char* name;
+        Joypad::Buttons::Button button;
+    } BUTTONS[] = {
+        { "UP", Joypad::Buttons::UP },
+        { "DOWN", Joypad::Buttons::DOWN },
+        { "LEFT", Joypad::Buttons::LEFT },
+        { "RIGHT", Joypad::Buttons::RIGHT },
+        { "A", Joypad::Buttons::A },
+        { "B", Joypad::Buttons::B },
+        { "START", Joypad::Buttons::START },
+        { "SELECT", Joypad::Buttons::SELECT },
+    };
+
+    for (auto& entry : BUTTONS) {
+        if (name == entry.name) {
+            button = entry.button;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_policy(const std::string& name, PPU::RenderPolicy::Policy& policy)
+{
+    if (name == "auto")
+        policy = PPU::RenderPolicy::AUTO;
+    else if (name == "fast")
+        policy = PPU::RenderPolicy::FAST;
+    else if (name == "accurate")
+        policy = PPU::RenderPolicy::ACCURATE;
+    else
+        return false;
+    return true;
+}
+
+static std::vector<InputEvent> load_inputs(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file) {
+        fprintf(stderr, "Could not open input script %s\n", path.c_str());
+        exit(-1);
+    }
+
+    std::vector<InputEvent> inputs;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream fields(line);
+        InputEvent event;
+        std::string button, state;
+        if (!(fields >> event.frame >> button >> state)
+                || !parse_button(button, event.button)
+                || (state != "down" && state != "up")) {
+            fprintf(stderr, "%s: bad input line '%s'\n", path.c_str(), line.c_str());
+            exit(-1);
+        }
+        event.pressed = state == "down";
+        inputs.push_back(event);
+    }
+    return inputs;
+}
+
+static std::vector<Entry> load_corpus(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file) {
+        fprintf(stderr, "Could not open corpus %s\n", path.c_str());
+        exit(-1);
+    }
+
+    auto directory = directory_of(path);
+    std::vector<Entry> corpus;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream fields(line);
+        Entry entry;
+        std::string inputs;
+        if (!(fields >> entry.rom >> entry.frames >> entry.policy_name)
+                || !parse_policy(entry.policy_name, entry.policy)) {
+            fprintf(stderr, "%s: bad corpus line '%s'\n", path.c_str(), line.c_str());
+            exit(-1);
+        }
+        entry.rom = directory + entry.rom;
+        if (fields >> inputs)
+            entry.inputs = load_inputs(directory + inputs);
+        corpus.push_back(entry);
+    }
+    return corpus;
+}
+
+static bool load_golden(const std::string& path, std::vector<FrameHashes>& golden)
+{
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file)
+        return false;
+
+    unsigned long long video, audio;
+    while (fscanf(file, "%llx %llx", &video, &audio) == 2)
+        golden.push_back({ video, audio });
+    fclose(file);
+    return true;
+}
+
+static void store_golden(const std::string& path, const std::vector<FrameHashes>& hashes)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+        fprintf(stderr, "Could not write %s\n", path.c_str());
+        exit(-1);
+    }
+    for (auto& frame : hashes)
+        fprintf(file, "%016llx %016llx\n",
+                (unsigned long long)frame.video,
+                (unsigned long long)frame.audio);
+    fclose(file);
+}
+
+// Returns false on a golden mismatch
+static bool run_entry(const Entry& entry, bool record)
+{
+    FILE* rom_file = fopen(entry.rom.c_str(), "rb");
+    if (!rom_file) {
+        printf("%-32s skipped, ROM not found\n", entry.rom.c_str());
+        return true;
+    }
+    fclose(rom_file);
+
+    auto rom = RomImage::load(entry.rom.c_str());
+    Cart cart(rom);
+    MemoryFrameSink frames;
+    HashAudioSink audio;
+    Emulator emulator(&cart, &frames, &audio);
+    emulator.ppu().set_render_policy(entry.policy);
+
+    std::vector<FrameHashes> hashes;
+    hashes.reserve(entry.frames);
+    usize next_input = 0;
+    u64 video_hash = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (u64 frame = 0; frame < entry.frames; ++frame) {
+        for (; next_input < entry.inputs.size()
+                && entry.inputs[next_input].frame <= frame; ++next_input) {
+            auto& input = entry.inputs[next_input];
+            emulator.joypad().set_button_status(input.button, input.pressed);
+        }
+
+        emulator.exec_to_next_frame();
+        if (frame == 0 || !emulator.frame_unchanged())
+            video_hash = XXHash64::hash(frames.frame().pixels, FRAME_BYTES);
+        hashes.push_back({ video_hash, audio.hash() });
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double fps = entry.frames / seconds;
+    double mhz = emulator.cpu().cycles() / seconds / 1e6;
+    printf("%-32s %-8s %6lu frames %8.3f s %9.1f fps %8.2f MHz  ",
+            entry.rom.c_str(),
+            entry.policy_name.c_str(),
+            entry.frames,
+            seconds,
+            fps,
+            mhz);
+
+    auto golden_path = entry.rom + ".golden";
+    if (entry.policy != PPU::RenderPolicy::AUTO)
+        golden_path = entry.rom + "." + entry.policy_name + ".golden";
+    if (record) {
+        store_golden(golden_path, hashes);
+        printf("recorded\n");
+        return true;
+    }
+
+    std::vector<FrameHashes> golden;
+    if (!load_golden(golden_path, golden)) {
+        printf("FAILED, no golden (run with --record)\n");
+        return false;
+    }
+    if (golden.size() != hashes.size()) {
+        printf("FAILED, golden has %lu frames\n", golden.size());
+        return false;
+    }
+    for (usize frame = 0; frame < hashes.size(); ++frame) {
+        if (hashes[frame].video != golden[frame].video) {
+            printf("FAILED, frame %lu differs\n", frame);
+            return false;
+        }
+        if (hashes[frame].audio != golden[frame].audio) {
+            printf("FAILED, audio differs by frame %lu\n", frame);
+            return false;
+        }
+    }
+    printf("ok\n");
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    bool record = false;
+    const char* corpus_path = nullptr;
+    for (int argument_index = 1; argument_index < argc; ++argument_index) {
+        if (!strcmp(argv[argument_index], "--record"))
+            record = true;
+        else
+            corpus_path = argv[argument_index];
+    }
+    if (!corpus_path) {
+        fprintf(stderr, "Usage: %s [--record] <corpus>\n", argv[0]);
+        exit(-1);
+    }
+
+    bool passed = true;
+    for (auto& entry : load_corpus(corpus_path))
+        passed = run_entry(entry, record) && passed;
+
+    return passed ? 0 : 1;
+}
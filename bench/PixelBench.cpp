@@ -0,0 +1,138 @@
+// Per-line cost of the line renderer inner loops: the per-pixel
+// TileData::color_at path against the scalar and dispatched PixelKernels.
+// Every line decodes its tile rows from scratch, which is the worst case for
+// the renderer (it normally reads them from the tile cache).
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "PPU.hpp"
+#include "PixelKernels.hpp"
+
+using namespace GB;
+
+static const usize LINE_COUNT = 144;
+static const usize FRAME_COUNT = 2000;
+static const u8 PALETTE = 0xe4;
+static const u32 SHADES[4] = { 0xc2f0c4, 0xa8b95a, 0x6e601e, 0x001b2d };
+
+struct Scene {
+    PPU::TileData tiles[256];
+    u8 tilemap[32 * 32];
+    u32 palette_lut[4];
+    u32 sprite_colors[LINE_COUNT][160];
+    u8 sprite_flags[LINE_COUNT][160];
+};
+
+static void fill_scene(Scene& scene)
+{
+    srand(0x6b);
+    for (auto& tile : scene.tiles)
+        for (auto& byte : tile.data)
+            byte = rand();
+    for (auto& tile_index : scene.tilemap)
+        tile_index = rand();
+
+    PPU::Palette palette { PALETTE };
+    for (u8 color_index = 0; color_index < 4; ++color_index)
+        scene.palette_lut[color_index] = SHADES[palette.color_for(color_index)];
+
+    // a few sprites on every line
+    for (usize y = 0; y < LINE_COUNT; ++y) {
+        for (usize x = 0; x < 160; ++x) {
+            scene.sprite_colors[y][x] = SHADES[rand() & 0x03];
+            int roll = rand() % 8;
+            scene.sprite_flags[y][x] = roll == 0
+                ? SpritePixel::FRONT
+                : roll == 1 ? SpritePixel::BEHIND_BG : SpritePixel::NONE;
+        }
+    }
+}
+
+static void render_color_at(Scene& scene, usize y, u32* colors)
+{
+    PPU::Palette palette { PALETTE };
+    for (usize x = 0; x < 160; ++x) {
+        auto& tile = scene.tiles[scene.tilemap[(y >> 3) * 32 + (x >> 3)]];
+        u8 color_index = tile.color_at(x % 8, y % 8);
+        colors[x] = SHADES[palette.color_for(color_index)];
+
+        auto flag = scene.sprite_flags[y][x];
+        if (flag == SpritePixel::FRONT
+                || (flag == SpritePixel::BEHIND_BG && color_index == 0))
+            colors[x] = scene.sprite_colors[y][x];
+    }
+}
+
+static void render_kernels(
+        const PixelKernels& kernels,
+        Scene& scene,
+        usize y,
+        u32* colors)
+{
+    u8 indices[160];
+    for (usize tile_x = 0; tile_x < 20; ++tile_x) {
+        auto& tile = scene.tiles[scene.tilemap[(y >> 3) * 32 + tile_x]];
+        kernels.decode_row(
+                tile.data[(y % 8) * 2],
+                tile.data[(y % 8) * 2 + 1],
+                indices + tile_x * 8);
+    }
+    kernels.map_palette(indices, scene.palette_lut, colors, 160);
+    kernels.compose(
+            indices,
+            scene.sprite_colors[y],
+            scene.sprite_flags[y],
+            colors,
+            160);
+}
+
+template <typename Render>
+static double time_lines(const char* name, u32* frame, Render render)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (usize frame_number = 0; frame_number < FRAME_COUNT; ++frame_number)
+        for (usize y = 0; y < LINE_COUNT; ++y)
+            render(y, frame + y * 160);
+    auto end = std::chrono::steady_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    double per_line = ns / (FRAME_COUNT * LINE_COUNT);
+    printf("%-16s %8.1f ns/line\n", name, per_line);
+    return per_line;
+}
+
+int main()
+{
+    static Scene scene;
+    fill_scene(scene);
+
+    static u32 reference[LINE_COUNT * 160];
+    static u32 scalar[LINE_COUNT * 160];
+    static u32 dispatched[LINE_COUNT * 160];
+
+    auto& scalar_kernels = scalar_pixel_kernels();
+    auto& best_kernels = pixel_kernels();
+
+    double reference_time = time_lines("color_at", reference,
+            [&](usize y, u32* colors) { render_color_at(scene, y, colors); });
+    time_lines("kernels/scalar", scalar,
+            [&](usize y, u32* colors) {
+                render_kernels(scalar_kernels, scene, y, colors);
+            });
+    double best_time = time_lines(best_kernels.name, dispatched,
+            [&](usize y, u32* colors) {
+                render_kernels(best_kernels, scene, y, colors);
+            });
+
+    if (memcmp(reference, scalar, sizeof(reference)) != 0
+            || memcmp(reference, dispatched, sizeof(reference)) != 0) {
+        fprintf(stderr, "Kernel output differs from the color_at path\n");
+        exit(-1);
+    }
+
+    printf("speedup: %.2fx\n", reference_time / best_time);
+    return 0;
+}
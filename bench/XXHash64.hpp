@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstring>
+
+#include "Defs.hpp"
+
+// XXH64, enough of it to hash frames and audio blocks. Chaining calls
+// through the seed hashes a stream.
+namespace XXHash64 {
+
+static const u64 PRIME1 = 0x9e3779b185ebca87ull;
+static const u64 PRIME2 = 0xc2b2ae3d27d4eb4full;
+static const u64 PRIME3 = 0x165667b19e3779f9ull;
+static const u64 PRIME4 = 0x85ebca77c2b2ae63ull;
+static const u64 PRIME5 = 0x27d4eb2f165667c5ull;
+
+static inline u64 rotate_left(u64 value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline u64 read64(const u8* data)
+{
+    u64 value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline u32 read32(const u8* data)
+{
+    u32 value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static inline u64 round(u64 accumulator, u64 input)
+{
+    accumulator += input * PRIME2;
+    accumulator = rotate_left(accumulator, 31);
+    return accumulator * PRIME1;
+}
+
+static inline u64 merge_round(u64 hash, u64 accumulator)
+{
+    hash ^= round(0, accumulator);
+    return hash * PRIME1 + PRIME4;
+}
+
+static inline u64 hash(const void* input, usize length, u64 seed = 0)
+{
+    auto* data = (const u8*)input;
+    auto* end = data + length;
+    u64 result;
+
+    if (length >= 32) {
+        u64 v1 = seed + PRIME1 + PRIME2;
+        u64 v2 = seed + PRIME2;
+        u64 v3 = seed;
+        u64 v4 = seed - PRIME1;
+        for (; data + 32 <= end; data += 32) {
+            v1 = round(v1, read64(data));
+            v2 = round(v2, read64(data + 8));
+            v3 = round(v3, read64(data + 16));
+            v4 = round(v4, read64(data + 24));
+        }
+        result = rotate_left(v1, 1) + rotate_left(v2, 7)
+            + rotate_left(v3, 12) + rotate_left(v4, 18);
+        result = merge_round(result, v1);
+        result = merge_round(result, v2);
+        result = merge_round(result, v3);
+        result = merge_round(result, v4);
+    } else {
+        result = seed + PRIME5;
+    }
+
+    result += length;
+
+    for (; data + 8 <= end; data += 8) {
+        result ^= round(0, read64(data));
+        result = rotate_left(result, 27) * PRIME1 + PRIME4;
+    }
+    if (data + 4 <= end) {
+        result ^= (u64)read32(data) * PRIME1;
+        result = rotate_left(result, 23) * PRIME2 + PRIME3;
+        data += 4;
+    }
+    for (; data < end; ++data) {
+        result ^= *data * PRIME5;
+        result = rotate_left(result, 11) * PRIME1;
+    }
+
+    result ^= result >> 33;
+    result *= PRIME2;
+    result ^= result >> 29;
+    result *= PRIME3;
+    result ^= result >> 32;
+    return result;
+}
+
+} // namespace XXHash64
@@ -1,151 +1,153 @@
 #include "APU.hpp"
 #include "Emulator.hpp"
+#include <algorithm>
 #include <cassert>
-#include <utility>
-#include <cstring>
 
 namespace GB {
 
-void audio_callback(void*, u8*, int);
+NullAudioSink APU::s_null_sink;
 
-APU::APU(Emulator& emulator)
+APU::APU(Emulator& emulator, AudioSink* sink)
     : m_emulator(emulator)
+    , m_sink(sink ? sink : &s_null_sink)
+    , m_mixing(m_sink->wants_samples())
+    , m_sample_rate(m_sink->sample_rate())
 {
-    SDL_AudioSpec desired_spec;
-    desired_spec.freq = 44100;
-    desired_spec.format = AUDIO_S8;
-    desired_spec.channels = 2;
-    desired_spec.samples = AUDIO_SAMPLES_COUNT;
-    desired_spec.callback = audio_callback;
-    desired_spec.userdata = (void*)this;
-
-    m_device_id = SDL_OpenAudioDevice(NULL, 0, &desired_spec, &m_audio_spec, 0);
-    if (m_device_id == 0) {
-        fprintf(stderr, "Could not open audio device: %s\n", SDL_GetError());
-        exit(-1);
-    }
-
-    m_front_buffer_empty = SDL_CreateSemaphore(1);
-    m_front_buffer = (i8*)malloc(m_audio_spec.size * 2);
-    m_back_buffer = m_front_buffer + m_audio_spec.size;
+    m_left.set_rates(CLOCK_RATE, m_sample_rate);
+    m_right.set_rates(CLOCK_RATE, m_sample_rate);
 }
 
-APU::~APU()
+void APU::set_muted(bool muted)
 {
-    SDL_CloseAudioDevice(m_device_id);
+    sync();
+    m_muted = muted;
+    bool mixing = !m_muted && m_sink->wants_samples();
+    if (mixing == m_mixing)
+        return;
 
-    if (m_front_buffer > m_back_buffer)
-        std::swap(m_front_buffer, m_back_buffer);
-    free(m_front_buffer);
+    // the buffers start over from silence, settle() steps up to the mix
+    m_mixing = mixing;
+    m_left.clear();
+    m_right.clear();
+    m_output[0] = 0;
+    m_output[1] = 0;
+    settle();
 }
 
-void APU::cycle()
+// Brings the channels up to the current clock
+void APU::sync()
 {
-    m_channel1.cycle();
-    m_channel2.cycle();
-    m_channel3.cycle();
-    m_channel4.cycle();
-
-    m_cycle_counter += 1000;
+    if (m_synced == m_clock)
+        return;
 
-    if (m_cycle_counter >= CYCLES_PER_SAMPLE) {
-        sample_audio();
-        m_cycle_counter %= CYCLES_PER_SAMPLE;
-    }
+    m_channel1.run(*this, m_synced, m_clock);
+    m_channel2.run(*this, m_synced, m_clock);
+    m_channel3.run(*this, m_synced, m_clock);
+    m_channel4.run(*this, m_synced, m_clock);
+    m_synced = m_clock;
 }
 
-void APU::pause()
+// After a register write: the channel levels and the mix may have changed
+void APU::settle()
 {
-    SDL_PauseAudioDevice(m_device_id, true);
-}
+    set_channel_level(0, m_clock, m_channel1.level());
+    set_channel_level(1, m_clock, m_channel2.level());
+    set_channel_level(2, m_clock, m_channel3.level());
+    set_channel_level(3, m_clock, m_channel4.level());
+    if (!m_mixing)
+        return;
 
-void APU::unpause()
-{
-    SDL_PauseAudioDevice(m_device_id, false);
+    i32 left_gain = sound_enabled() ? left_volume() * OUTPUT_GAIN : 0;
+    i32 right_gain = sound_enabled() ? right_volume() * OUTPUT_GAIN : 0;
+    i32 left = 0;
+    i32 right = 0;
+    for (usize channel = 0; channel < 4; ++channel) {
+        if (m_NR51 & (0x10 << channel))
+            left += m_levels[channel] * left_gain;
+        if (m_NR51 & (0x01 << channel))
+            right += m_levels[channel] * right_gain;
+    }
+
+    if (left != m_output[0])
+        m_left.add_delta(m_clock, left - m_output[0]);
+    if (right != m_output[1])
+        m_right.add_delta(m_clock, right - m_output[1]);
+    m_output[0] = left;
+    m_output[1] = right;
 }
 
-void APU::callback(i8* audio_stream, int length)
+void APU::set_channel_level(usize channel, u32 time, u8 level)
 {
-    if (SDL_SemValue(m_front_buffer_empty)) {
-        std::memset(audio_stream, 0, length);
-        fprintf(stderr, "WARNING: audio can't keep up!\n");
+    i32 delta = (i32)level - m_levels[channel];
+    if (delta == 0)
         return;
-    }
+    m_levels[channel] = level;
 
-    std::memcpy(audio_stream, m_front_buffer, length);
-    SDL_SemPost(m_front_buffer_empty);
+    if (!m_mixing || !sound_enabled())
+        return;
+    if (m_NR51 & (0x10 << channel)) {
+        i32 left = delta * left_volume() * OUTPUT_GAIN;
+        m_left.add_delta(time, left);
+        m_output[0] += left;
+    }
+    if (m_NR51 & (0x01 << channel)) {
+        i32 right = delta * right_volume() * OUTPUT_GAIN;
+        m_right.add_delta(time, right);
+        m_output[1] += right;
+    }
 }
 
-void audio_callback(void* apu, u8* audio_stream, int stream_length)
+void APU::end_block()
 {
-    reinterpret_cast<APU*>(apu)
-        ->callback(reinterpret_cast<i8*>(audio_stream), stream_length);
+    sync();
+    u32 clocks = m_clock;
+    m_clock = 0;
+    m_synced = 0;
+    if (!m_mixing)
+        return;
+
+    m_left.end_block(clocks);
+    m_right.end_block(clocks);
+
+    usize count = m_left.read_samples(m_block, BLOCK_SAMPLES, 2);
+    m_right.read_samples(m_block + 1, count, 2);
+    m_sink->write(m_block, 2 * count);
+
+    // the sink may be following another clock
+    double rate = m_sink->sample_rate();
+    if (rate != m_sample_rate) {
+        m_sample_rate = rate;
+        m_left.set_rates(CLOCK_RATE, m_sample_rate);
+        m_right.set_rates(CLOCK_RATE, m_sample_rate);
+    }
 }
 
-void APU::sample_audio()
+// Lengths on even steps, sweep on 2 and 6, envelopes on 7
+void APU::step_frame_sequencer()
 {
-    if (!sound_enabled()) {
-        add_sample(silence(), silence());
+    // powered off, all channels are stopped and the step restarts from 0
+    // on power on: there is nothing to clock
+    if (!sound_enabled())
         return;
-    }
 
-    float left_output = 0.0;
-    float right_output = 0.0;
-
-#if 1
-    float channel1_sample = m_channel1.sample();
-    float channel2_sample = m_channel2.sample();
-    float channel3_sample = m_channel3.sample();
-#else
-    float channel1_sample = 0.0;
-    float channel2_sample = 0.0;
-    float channel3_sample = 0.0;
-#endif
-    float channel4_sample = m_channel4.sample();
-
-    if (channel1_to_left())
-        left_output += channel1_sample;
-    if (channel1_to_right())
-        right_output += channel1_sample;
-    if (channel2_to_left())
-        left_output += channel2_sample;
-    if (channel2_to_right())
-        right_output += channel2_sample;
-    if (channel3_to_left())
-        left_output += channel3_sample;
-    if (channel3_to_right())
-        right_output += channel3_sample;
-    if (channel4_to_left())
-        left_output += channel4_sample;
-    if (channel4_to_right())
-        right_output += channel4_sample;
-
-    left_output *= left_volume() * BASE_VOLUME;
-    right_output *= right_volume() * BASE_VOLUME;
-
-    if (left_output > 1.0)
-        left_output = 1.0;
-    if (right_output > 1.0)
-        right_output = 1.0;
-
-    i8 left_sample = (i8)(left_output * 127);
-    i8 right_sample = (i8)(right_output * 127);
-
-    add_sample(left_sample, right_sample);
-}
-
-void APU::add_sample(i8 left_sample, i8 right_sample)
-{
-    m_back_buffer[m_buffer_pos] = left_sample;
-    ++m_buffer_pos;
-    m_back_buffer[m_buffer_pos] = right_sample;
-    ++m_buffer_pos;
-
-    if (m_buffer_pos >= m_audio_spec.size) {
-        SDL_SemWait(m_front_buffer_empty);
-        std::swap(m_front_buffer, m_back_buffer);
-        m_buffer_pos = 0;
+    sync();
+
+    if (!(m_frame_step & 1)) {
+        m_channel1.tick_length();
+        m_channel2.tick_length();
+        m_channel3.tick_length();
+        m_channel4.tick_length();
     }
+    if (m_frame_step == 2 || m_frame_step == 6)
+        m_channel1.tick_sweep();
+    if (m_frame_step == 7) {
+        m_channel1.tick_envelope();
+        m_channel2.tick_envelope();
+        m_channel4.tick_envelope();
+    }
+    m_frame_step = (m_frame_step + 1) & 7;
+
+    settle();
 }
 
 void APU::stop()
@@ -178,39 +180,77 @@ void APU::stop()
     m_channel4.set_NR44(0);
 }
 
-static const usize CYCLES_PER_SWEEP_TICK = 32768;
-static const usize CYCLES_PER_LENGTH_TICK = 16384;
-static const usize CYCLES_PER_ENVELOPE_TICK = 65536;
+// Cycles until a timer counting up from `counter` fires at `limit`
+static inline u32 cycles_until(usize counter, usize limit)
+{
+    return counter + 1 > limit ? 1 : limit - counter;
+}
 
-void Channel1::cycle()
+// Runs such a timer for `cycles` clocks at once, returning how many times
+// it fired
+static usize skip_timer(usize& counter, usize limit, u32 cycles)
 {
-    ++m_duty_timer;
+    if (cycles == 0)
+        return 0;
 
-    if (m_duty_timer >= period()) {
-        m_duty_timer = 0;
-        cycle_frequency();
+    usize fired = 0;
+    // a limit lowered below the counter fires on the next clock
+    if (counter >= limit) {
+        fired = 1;
+        counter = 0;
+        --cycles;
     }
+    counter += cycles;
+    fired += counter / limit;
+    counter %= limit;
+    return fired;
+}
 
-    ++m_sweep_timer;
-    if (m_sweep_timer >= CYCLES_PER_SWEEP_TICK) {
-        m_sweep_timer = 0;
-        if (sweep_time() != 0)
-            cycle_sweep();
+// Skips from one step of the waveform to the next, or straight to the end
+// while nothing can be heard
+void Channel1::run(APU& apu, u32 time, u32 end)
+{
+    if (m_stopped || (m_envelope_volume & 0x0f) == 0 || !apu.channel_audible(0)) {
+        skip(end - time);
+        apu.set_channel_level(0, end, level());
+        return;
     }
 
-    ++m_length_timer;
-    if (m_length_timer >= CYCLES_PER_LENGTH_TICK) {
-        m_length_timer = 0;
-        if (m_length_counter != 0)
-            cycle_length();
+    while (time < end) {
+        u32 cycles = std::min(end - time, cycles_until(m_duty_timer, period()));
+        time += cycles;
+        m_duty_timer += cycles;
+        if (m_duty_timer >= period()) {
+            m_duty_timer = 0;
+            cycle_frequency();
+        }
+        apu.set_channel_level(0, time, level());
     }
+}
 
-    ++m_envelope_timer;
-    if (m_envelope_timer >= CYCLES_PER_ENVELOPE_TICK) {
-        m_envelope_timer = 0;
-        if (envelope_period() != 0)
-            cycle_envelope();
-    }
+void Channel1::skip(u32 cycles)
+{
+    usize timer = m_duty_timer;
+    m_frequency_timer = (m_frequency_timer + skip_timer(timer, period(), cycles)) % 8;
+    m_duty_timer = timer;
+}
+
+void Channel1::tick_length()
+{
+    if (m_length_counter != 0)
+        cycle_length();
+}
+
+void Channel1::tick_sweep()
+{
+    if (sweep_time() != 0)
+        cycle_sweep();
+}
+
+void Channel1::tick_envelope()
+{
+    if (envelope_period() != 0)
+        cycle_envelope();
 }
 
 void Channel1::cycle_frequency()
@@ -266,37 +306,51 @@ void Channel1::restart()
     m_stopped = false;
 }
 
-float Channel1::sample()
+u8 Channel1::level() const
 {
     if (stopped())
         return 0;
 
-    auto volume = (float)(m_envelope_volume & 0xf) / (float)0xf;
-    return volume * (float)DUTIES[duty()][m_frequency_timer];
+    return (m_envelope_volume & 0x0f) * DUTIES[duty()][m_frequency_timer];
 }
 
-void Channel2::cycle()
+void Channel2::run(APU& apu, u32 time, u32 end)
 {
-    ++m_duty_timer;
-
-    if (m_duty_timer >= period()) {
-        m_duty_timer = 0;
-        cycle_frequency();
+    if (m_stopped || (m_envelope_volume & 0x0f) == 0 || !apu.channel_audible(1)) {
+        skip(end - time);
+        apu.set_channel_level(1, end, level());
+        return;
     }
 
-    ++m_length_timer;
-    if (m_length_timer >= CYCLES_PER_LENGTH_TICK) {
-        m_length_timer = 0;
-        if (m_length_counter != 0)
-            cycle_length();
+    while (time < end) {
+        u32 cycles = std::min(end - time, cycles_until(m_duty_timer, period()));
+        time += cycles;
+        m_duty_timer += cycles;
+        if (m_duty_timer >= period()) {
+            m_duty_timer = 0;
+            cycle_frequency();
+        }
+        apu.set_channel_level(1, time, level());
     }
+}
 
-    ++m_envelope_timer;
-    if (m_envelope_timer >= CYCLES_PER_ENVELOPE_TICK) {
-        m_envelope_timer = 0;
-        if (envelope_period() != 0)
-            cycle_envelope();
-    }
+void Channel2::skip(u32 cycles)
+{
+    usize timer = m_duty_timer;
+    m_frequency_timer = (m_frequency_timer + skip_timer(timer, period(), cycles)) % 8;
+    m_duty_timer = timer;
+}
+
+void Channel2::tick_length()
+{
+    if (m_length_counter != 0)
+        cycle_length();
+}
+
+void Channel2::tick_envelope()
+{
+    if (envelope_period() != 0)
+        cycle_envelope();
 }
 
 void Channel2::cycle_frequency()
@@ -339,31 +393,46 @@ void Channel2::restart()
     m_stopped = false;
 }
 
-float Channel2::sample()
+u8 Channel2::level() const
 {
     if (stopped())
         return 0;
 
-    auto volume = (float)(m_envelope_volume & 0xf) / (float)0xf;
-    return volume * (float)DUTIES[duty()][m_frequency_timer];
+    return (m_envelope_volume & 0x0f) * DUTIES[duty()][m_frequency_timer];
 }
 
-void Channel3::cycle()
+void Channel3::run(APU& apu, u32 time, u32 end)
 {
-    ++m_frequency_timer;
-    if (m_frequency_timer >= period()) {
-        m_frequency_timer = 0;
-        cycle_frequency();
+    if (m_stopped || !playing() || output_level() == 0 || !apu.channel_audible(2)) {
+        skip(end - time);
+        apu.set_channel_level(2, end, level());
+        return;
     }
 
-    ++m_length_timer;
-    if (m_length_timer >= CYCLES_PER_LENGTH_TICK) {
-        m_length_timer = 0;
-        if (m_length_counter != 0)
-            cycle_length();
+    while (time < end) {
+        u32 cycles = std::min(end - time, cycles_until(m_frequency_timer, period()));
+        time += cycles;
+        m_frequency_timer += cycles;
+        if (m_frequency_timer >= period()) {
+            m_frequency_timer = 0;
+            cycle_frequency();
+        }
+        apu.set_channel_level(2, time, level());
     }
 }
 
+void Channel3::skip(u32 cycles)
+{
+    usize steps = skip_timer(m_frequency_timer, period(), cycles);
+    m_wave_position = (m_wave_position + steps) & 0x1f;
+}
+
+void Channel3::tick_length()
+{
+    if (m_length_counter != 0)
+        cycle_length();
+}
+
 void Channel3::cycle_frequency()
 {
     m_wave_position = (m_wave_position + 1) & 0x1f;
@@ -387,58 +456,139 @@ void Channel3::restart()
     m_stopped = false;
 }
 
-float Channel3::sample()
+u8 Channel3::level() const
 {
     if (stopped())
-        return 0.0;
+        return 0;
 
     if (!playing())
-        return 0.0;
+        return 0;
 
     if (output_level() == 0)
-        return 0.0;
+        return 0;
 
     u8 sample_byte = m_wave_pattern[m_wave_position >> 1];
     u8 sample_value = (m_wave_position & 1)
         ? ((sample_byte & 0xf0) >> 4)
         : (sample_byte & 0x0f);
-    float sample = (float)(sample_value >> (output_level() - 1)) / (float)0xf;
-    return sample;
+    return sample_value >> (output_level() - 1);
 }
 
-void Channel4::cycle()
+// Stepping the LFSR is linear over GF(2) once bit 15, only set on restart,
+// has shifted out: n steps are the step matrix to the n applied to the
+// register. The tables hold the powers 2^k of the matrix of each width,
+// sliced by nibble of the register, so a jump costs 4 lookups per set bit
+// of n.
+static const usize LFSR_JUMP_POWERS = 32;
+static u16 s_lfsr_jumps[2][LFSR_JUMP_POWERS][4][16];
+
+static u16 lfsr_step(u16 value, bool soft)
 {
-    ++m_frequency_timer;
-    if (m_frequency_timer >= period()) {
-        m_frequency_timer = 0;
-        cycle_frequency();
+    bool bit_0 = value & 0x0001;
+    bool bit_1 = value & 0x0002;
+    bool bit = bit_0 != bit_1;
+    value >>= 1;
+    value |= bit ? 0x4000 : 0;
+
+    if (soft)
+        value = (value & ~0x00400) | (bit ? 0x00400 : 0);
+    return value;
+}
+
+static u16 lfsr_apply(const u16 (&table)[4][16], u16 value)
+{
+    return table[0][value & 0xf]
+        ^ table[1][(value >> 4) & 0xf]
+        ^ table[2][(value >> 8) & 0xf]
+        ^ table[3][value >> 12];
+}
+
+static bool build_lfsr_jumps()
+{
+    for (usize soft = 0; soft < 2; ++soft) {
+        u16 columns[16] {};
+        for (usize bit = 0; bit < 15; ++bit)
+            columns[bit] = lfsr_step(1 << bit, soft);
+
+        for (usize power = 0; power < LFSR_JUMP_POWERS; ++power) {
+            auto& table = s_lfsr_jumps[soft][power];
+            for (usize slice = 0; slice < 4; ++slice) {
+                for (usize nibble = 0; nibble < 16; ++nibble) {
+                    u16 value = 0;
+                    for (usize bit = 0; bit < 4; ++bit)
+                        if (nibble & (1 << bit))
+                            value ^= columns[slice * 4 + bit];
+                    table[slice][nibble] = value;
+                }
+            }
+
+            // squared for the next power
+            for (usize bit = 0; bit < 15; ++bit)
+                columns[bit] = lfsr_apply(table, columns[bit]);
+        }
+    }
+    return true;
+}
+
+static u16 lfsr_jump(u16 value, u32 steps, bool soft)
+{
+    // built once, safely across emulators on different threads
+    static const bool built = build_lfsr_jumps();
+    (void)built;
+
+    if (steps && (value & 0x8000)) {
+        value = lfsr_step(value, soft);
+        --steps;
     }
+    for (usize power = 0; steps; ++power, steps >>= 1)
+        if (steps & 1)
+            value = lfsr_apply(s_lfsr_jumps[soft][power], value);
+    return value;
+}
 
-    ++m_length_timer;
-    if (m_length_timer >= CYCLES_PER_LENGTH_TICK) {
-        m_length_timer = 0;
-        if (m_length_counter != 0)
-            cycle_length();
+void Channel4::run(APU& apu, u32 time, u32 end)
+{
+    // unheard, the register only has to end up in the right state
+    if (m_stopped || (m_envelope_volume & 0x0f) == 0 || !apu.channel_audible(3)) {
+        skip(end - time);
+        apu.set_channel_level(3, end, level());
+        return;
     }
 
-    ++m_envelope_timer;
-    if (m_envelope_timer >= CYCLES_PER_ENVELOPE_TICK) {
-        m_envelope_timer = 0;
-        if (envelope_period() != 0)
-            cycle_envelope();
+    while (time < end) {
+        u32 cycles = std::min(end - time, cycles_until(m_frequency_timer, period()));
+        time += cycles;
+        m_frequency_timer += cycles;
+        if (m_frequency_timer >= period()) {
+            m_frequency_timer = 0;
+            cycle_frequency();
+        }
+        apu.set_channel_level(3, time, level());
     }
 }
 
-void Channel4::cycle_frequency()
+void Channel4::tick_length()
 {
-    bool bit_0 = m_shift_register & 0x0001;
-    bool bit_1 = m_shift_register & 0x0002;
-    bool bit = bit_0 != bit_1;
-    m_shift_register >>= 1;
-    m_shift_register |= bit ? 0x4000 : 0;
+    if (m_length_counter != 0)
+        cycle_length();
+}
+
+void Channel4::tick_envelope()
+{
+    if (envelope_period() != 0)
+        cycle_envelope();
+}
 
-    if (soft_sound())
-        m_shift_register = (m_shift_register & ~0x00400) | (bit ? 0x00400 : 0);
+// Advances the timer and the register as `cycles` single clocks would
+void Channel4::skip(u32 cycles)
+{
+    usize steps = skip_timer(m_frequency_timer, period(), cycles);
+    m_shift_register = lfsr_jump(m_shift_register, steps, soft_sound());
+}
+
+void Channel4::cycle_frequency()
+{
+    m_shift_register = lfsr_step(m_shift_register, soft_sound());
 }
 
 void Channel4::cycle_length()
@@ -476,15 +626,12 @@ void Channel4::restart()
     m_stopped = false;
 }
 
-float Channel4::sample()
+u8 Channel4::level() const
 {
     if (m_stopped)
-        return 0.0;
+        return 0;
 
-    auto volume = (float)(m_envelope_volume & 0x0f) / (float)0xf;
-    float sample = ((m_shift_register & 0x0001) ? 0.0 : volume);
-    //printf("%04x -> %f (%02x)\n", m_shift_register, sample, m_envelope_volume);
-    return sample;
+    return (m_shift_register & 0x0001) ? 0 : (m_envelope_volume & 0x0f);
 }
 
 
@@ -1,13 +1,15 @@
 #pragma once
 
 #include "Defs.hpp"
-#include <SDL2/SDL.h>
+#include "AudioSink.hpp"
+#include "DeltaBuffer.hpp"
 
 namespace GB {
 
-static const usize AUDIO_SAMPLES_COUNT = 1024;
-static const usize CYCLES_PER_SAMPLE = (usize)(4194304.0 * 1000.0 / 44100.0);
-static const float BASE_VOLUME = 0.10;
+static const u32 CLOCK_RATE = 4194304;
+// 16-bit output per unit of channel level times master volume, all four
+// channels at full volume reach 40% of the range
+static const i32 OUTPUT_GAIN = 31;
 
 static const u8 DUTIES[4][8] = {
     { 0, 0, 0, 0, 0, 0, 0, 1 },
@@ -20,8 +22,12 @@ class APU;
 
 class Channel1 {
     public:
-        void cycle();
-        float sample();
+        void run(APU&, u32 time, u32 end);
+        u8 level() const;
+        // frame sequencer ticks
+        void tick_length();
+        void tick_sweep();
+        void tick_envelope();
         inline bool stopped() const { return m_stopped; }
         inline void stop() { m_stopped = true; }
 
@@ -75,14 +81,12 @@ class Channel1 {
         bool m_stopped { true };
         u16 m_duty_timer { 0 };
         usize m_frequency_timer { 0 };
-        usize m_sweep_timer { 0 };
         usize m_sweep_counter { 0 };
-        usize m_length_timer { 0 };
         u8 m_length_counter { 0 };
-        usize m_envelope_timer { 0 };
         usize m_envelope_counter { 0 };
         u8 m_envelope_volume { 0 };
 
+        void skip(u32 cycles);
         void cycle_frequency();
         void cycle_sweep();
         void cycle_length();
@@ -100,8 +104,11 @@ class Channel1 {
 
 class Channel2 {
     public:
-        void cycle();
-        float sample();
+        void run(APU&, u32 time, u32 end);
+        u8 level() const;
+        // frame sequencer ticks
+        void tick_length();
+        void tick_envelope();
         inline bool stopped() const { return m_stopped; }
         inline void stop() { m_stopped = true; }
 
@@ -145,12 +152,11 @@ class Channel2 {
         bool m_stopped { true };
         u16 m_duty_timer { 0 };
         usize m_frequency_timer { 0 };
-        usize m_length_timer { 0 };
         u8 m_length_counter { 0 };
-        usize m_envelope_timer { 0 };
         usize m_envelope_counter { 0 };
         u8 m_envelope_volume { 0 };
 
+        void skip(u32 cycles);
         void cycle_frequency();
         void cycle_length();
         void cycle_envelope();
@@ -167,8 +173,10 @@ class Channel2 {
 
 class Channel3 {
     public:
-        void cycle();
-        float sample();
+        void run(APU&, u32 time, u32 end);
+        u8 level() const;
+        // frame sequencer ticks
+        void tick_length();
         inline void stop() { m_stopped = true; }
         inline bool stopped() const { return m_stopped; }
 
@@ -194,7 +202,7 @@ class Channel3 {
         inline void set_wave_pattern(u8 value, u8 offset)
         {
             if (playing())
-                m_wave_pattern[m_wave_position] = value; // DMG quirk
+                m_wave_pattern[m_wave_position >> 1] = value; // DMG quirk
             else
                 m_wave_pattern[offset] = value;
         }
@@ -221,9 +229,9 @@ class Channel3 {
         bool m_stopped { true };
         usize m_frequency_timer { 0 };
         usize m_wave_position { 0 };
-        usize m_length_timer { 0 };
         usize m_length_counter { 0 };
 
+        void skip(u32 cycles);
         void cycle_frequency();
         void cycle_length();
         void restart();
@@ -231,8 +239,11 @@ class Channel3 {
 
 class Channel4 {
     public:
-        void cycle();
-        float sample();
+        void run(APU&, u32 time, u32 end);
+        u8 level() const;
+        // frame sequencer ticks
+        void tick_length();
+        void tick_envelope();
 
         inline bool stopped() const { return m_stopped; }
         inline void stop() { m_stopped = true; }
@@ -275,13 +286,12 @@ class Channel4 {
 
         bool m_stopped { true };
         usize m_frequency_timer { 0 };
-        usize m_length_timer { 0 };
         usize m_length_counter { 0 };
-        usize m_envelope_timer { 0 };
         usize m_envelope_counter { 0 };
         u8 m_envelope_volume { 0 };
         u16 m_shift_register { 0 };
 
+        void skip(u32 cycles);
         void cycle_frequency();
         void cycle_length();
         void cycle_envelope();
@@ -292,22 +302,42 @@ class Emulator;
 
 class APU {
     public:
-        explicit APU(Emulator&);
-        ~APU();
+        // samples go to the sink, nullptr to not mix them at all
+        APU(Emulator&, AudioSink*);
 
-        void cycle();
-        void pause();
-        void unpause();
-        inline u8 silence() const { return m_audio_spec.silence; }
+        // once per T-cycle
+        inline void cycle()
+        {
+            if (++m_clock == BLOCK_CLOCKS)
+                end_block();
+        }
+        inline void pause() { m_sink->pause(); }
+        inline void unpause() { m_sink->unpause(); }
+        // Muted, nothing is mixed or sent to the sink, the channels only
+        // keep their state
+        void set_muted(bool muted);
+        inline bool muted() const { return m_muted; }
+
+        // A channel's output changed to `level` (0-15), `time` clocks into
+        // the current block
+        void set_channel_level(usize channel, u32 time, u8 level);
+        // whether a channel's level can reach the output at all
+        inline bool channel_audible(usize channel) const
+        {
+            return m_mixing && sound_enabled() && (m_NR51 & (0x11 << channel));
+        }
 
-        void callback(i8*,int);
+        // On each falling edge of DIV bit 12, 512 times a second: clocks
+        // the length counters, sweep and envelopes on hardware's schedule
+        void step_frame_sequencer();
 
         inline u8 NR50() const { return m_NR50; }
-        inline void set_NR50(u8 value) { m_NR50 = value; }
+        inline void set_NR50(u8 value) { sync(); m_NR50 = value; settle(); }
         inline u8 NR51() const { return m_NR51; }
-        inline void set_NR51(u8 value) { m_NR51 = value; }
-        inline u8 NR52() const
+        inline void set_NR51(u8 value) { sync(); m_NR51 = value; settle(); }
+        inline u8 NR52()
         {
+            sync();
             return (m_NR52 & 0x80)
                 | (m_channel1.stopped() ? 0 : 0x01)
                 | (m_channel2.stopped() ? 0 : 0x02)
@@ -316,9 +346,14 @@ class APU {
                 | 0x70;
         }
         inline void set_NR52(u8 value) {
+            sync();
+            // powering on restarts the frame sequencer
+            if (!(m_NR52 & 0x80) && (value & 0x80))
+                m_frame_step = 0;
             m_NR52 = value;
             if (!(m_NR52 & 0x80))
                 stop();
+            settle();
         }
 
         inline Channel1& channel1() { return m_channel1; }
@@ -327,14 +362,8 @@ class APU {
         inline Channel4& channel4() { return m_channel4; }
 
         inline bool sound_enabled() const { return m_NR52 & 0x80; }
-        inline float left_volume() const
-        {
-            return (float)((m_NR50 & 0x70) >> 4) / 7.0;
-        }
-        inline float right_volume() const
-        {
-            return (float)(m_NR50 & 0x07) / 7.0;
-        }
+        inline u8 left_volume() const { return (m_NR50 & 0x70) >> 4; }
+        inline u8 right_volume() const { return m_NR50 & 0x07; }
         inline bool channel1_to_left() const { return m_NR51 & 0x10; }
         inline bool channel2_to_left() const { return m_NR51 & 0x20; }
         inline bool channel3_to_left() const { return m_NR51 & 0x40; }
@@ -345,69 +374,87 @@ class APU {
         inline bool channel4_to_right() const { return m_NR51 & 0x08; }
 
         inline u8 NR10() const { return m_channel1.NR10(); }
-        inline void set_NR10(u8 value) { m_channel1.set_NR10(value); }
+        inline void set_NR10(u8 value) { sync(); m_channel1.set_NR10(value); settle(); }
         inline u8 NR11() const { return m_channel1.NR11(); }
-        inline void set_NR11(u8 value) { m_channel1.set_NR11(value); }
+        inline void set_NR11(u8 value) { sync(); m_channel1.set_NR11(value); settle(); }
         inline u8 NR12() const { return m_channel1.NR12(); }
-        inline void set_NR12(u8 value) { m_channel1.set_NR12(value); }
+        inline void set_NR12(u8 value) { sync(); m_channel1.set_NR12(value); settle(); }
         inline u8 NR13() const { return m_channel1.NR13(); }
-        inline void set_NR13(u8 value) { m_channel1.set_NR13(value); }
+        inline void set_NR13(u8 value) { sync(); m_channel1.set_NR13(value); settle(); }
         inline u8 NR14() const { return m_channel1.NR14(); }
-        inline void set_NR14(u8 value) { m_channel1.set_NR14(value); }
+        inline void set_NR14(u8 value) { sync(); m_channel1.set_NR14(value); settle(); }
 
         inline u8 NR20() const { return m_channel2.NR20(); }
         inline u8 NR21() const { return m_channel2.NR21(); }
-        inline void set_NR21(u8 value) { m_channel2.set_NR21(value); }
+        inline void set_NR21(u8 value) { sync(); m_channel2.set_NR21(value); settle(); }
         inline u8 NR22() const { return m_channel2.NR22(); }
-        inline void set_NR22(u8 value) { m_channel2.set_NR22(value); }
+        inline void set_NR22(u8 value) { sync(); m_channel2.set_NR22(value); settle(); }
         inline u8 NR23() const { return m_channel2.NR23(); }
-        inline void set_NR23(u8 value) { m_channel2.set_NR23(value); }
+        inline void set_NR23(u8 value) { sync(); m_channel2.set_NR23(value); settle(); }
         inline u8 NR24() const { return m_channel2.NR24(); }
-        inline void set_NR24(u8 value) { m_channel2.set_NR24(value); }
+        inline void set_NR24(u8 value) { sync(); m_channel2.set_NR24(value); settle(); }
 
         inline u8 NR30() const { return m_channel3.NR30(); }
-        inline void set_NR30(u8 value) { m_channel3.set_NR30(value); }
+        inline void set_NR30(u8 value) { sync(); m_channel3.set_NR30(value); settle(); }
         inline u8 NR31() const { return m_channel3.NR31(); }
-        inline void set_NR31(u8 value) { m_channel3.set_NR31(value); }
+        inline void set_NR31(u8 value) { sync(); m_channel3.set_NR31(value); settle(); }
         inline u8 NR32() const { return m_channel3.NR32(); }
-        inline void set_NR32(u8 value) { m_channel3.set_NR32(value); }
+        inline void set_NR32(u8 value) { sync(); m_channel3.set_NR32(value); settle(); }
         inline u8 NR33() const { return m_channel3.NR33(); }
-        inline void set_NR33(u8 value) { m_channel3.set_NR33(value); }
+        inline void set_NR33(u8 value) { sync(); m_channel3.set_NR33(value); settle(); }
         inline u8 NR34() const { return m_channel3.NR34(); }
-        inline void set_NR34(u8 value) { m_channel3.set_NR34(value); }
+        inline void set_NR34(u8 value) { sync(); m_channel3.set_NR34(value); settle(); }
         inline u8 read_wave_pattern(u8 offset) const
         {
             return m_channel3.read_wave_pattern(offset);
         }
         inline void set_wave_pattern(u8 value, u8 offset)
         {
+            sync();
             m_channel3.set_wave_pattern(value, offset);
+            settle();
         }
 
         inline u8 NR40() const { return m_channel4.NR40(); }
         inline u8 NR41() const { return m_channel4.NR41(); }
-        inline void set_NR41(u8 value) { m_channel4.set_NR41(value); }
+        inline void set_NR41(u8 value) { sync(); m_channel4.set_NR41(value); settle(); }
         inline u8 NR42() const { return m_channel4.NR42(); }
-        inline void set_NR42(u8 value) { m_channel4.set_NR42(value); }
+        inline void set_NR42(u8 value) { sync(); m_channel4.set_NR42(value); settle(); }
         inline u8 NR43() const { return m_channel4.NR43(); }
-        inline void set_NR43(u8 value) { m_channel4.set_NR43(value); }
+        inline void set_NR43(u8 value) { sync(); m_channel4.set_NR43(value); settle(); }
         inline u8 NR44() const { return m_channel4.NR44(); }
-        inline void set_NR44(u8 value) { m_channel4.set_NR44(value); }
+        inline void set_NR44(u8 value) { sync(); m_channel4.set_NR44(value); settle(); }
 
     private:
         Emulator& m_emulator;
 
-        SDL_AudioDeviceID m_device_id;
-        SDL_AudioSpec m_audio_spec;
-
-        SDL_sem* m_front_buffer_empty { nullptr };
-        i8* m_front_buffer { nullptr };
-        i8* m_back_buffer { nullptr };
-        usize m_buffer_pos { 0 };
-        usize m_cycle_counter { 0 };
-
-        void sample_audio();
-        void add_sample(i8 left, i8 right);
+        static NullAudioSink s_null_sink;
+        AudioSink* m_sink;
+        // mixing is skipped entirely while muted and for sinks that want
+        // no samples
+        bool m_muted { false };
+        bool m_mixing;
+        double m_sample_rate;
+
+        // Channels only run when their registers are accessed and at the
+        // end of each block, their output changes go to the delta buffers.
+        static const u32 BLOCK_CLOCKS = 8192;
+        static const usize BLOCK_SAMPLES = 256;
+
+        DeltaBuffer m_left { CLOCK_RATE, 44100, BLOCK_SAMPLES };
+        DeltaBuffer m_right { CLOCK_RATE, 44100, BLOCK_SAMPLES };
+        i16 m_block[2 * BLOCK_SAMPLES];
+        // clocks into the current block, and up to where the channels ran
+        u32 m_clock { 0 };
+        u32 m_synced { 0 };
+        u8 m_levels[4] {};
+        // what the delta buffers add up to
+        i32 m_output[2] {};
+        u8 m_frame_step { 0 };
+
+        void sync();
+        void settle();
+        void end_block();
         void stop();
 
         u8 m_NR50 { 0 };
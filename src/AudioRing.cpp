@@ -0,0 +1,70 @@
+#include "AudioRing.hpp"
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+namespace GB {
+
+AudioRing::AudioRing(usize capacity, usize frame_size)
+{
+    assert(frame_size && !(frame_size & (frame_size - 1)));
+
+    usize size = 2;
+    while (size < capacity)
+        size <<= 1;
+
+    while (size < frame_size)
+        size <<= 1;
+
+    m_buffer = (u8*)malloc(size);
+    assert(m_buffer);
+    m_mask = size - 1;
+    m_frame_mask = ~(frame_size - 1);
+}
+
+AudioRing::~AudioRing()
+{
+    free(m_buffer);
+}
+
+// Copies in at most two pieces, the ring wrapping around once
+usize AudioRing::write(const u8* samples, usize length)
+{
+    usize tail = m_tail.load(std::memory_order_relaxed);
+    usize space = capacity() - (tail - m_head.load(std::memory_order_acquire));
+
+    usize count = (length < space ? length : space) & m_frame_mask;
+    if (count < length)
+        m_overruns.fetch_add(1, std::memory_order_relaxed);
+
+    usize offset = tail & m_mask;
+    usize first = count < capacity() - offset ? count : capacity() - offset;
+    std::memcpy(m_buffer + offset, samples, first);
+    std::memcpy(m_buffer, samples + first, count - first);
+
+    m_tail.store(tail + count, std::memory_order_release);
+    return count;
+}
+
+usize AudioRing::read(u8* samples, usize length, u8 silence)
+{
+    usize head = m_head.load(std::memory_order_relaxed);
+    usize available = m_tail.load(std::memory_order_acquire) - head;
+
+    usize count = (length < available ? length : available) & m_frame_mask;
+    if (count < length) {
+        m_underruns.fetch_add(1, std::memory_order_relaxed);
+        std::memset(samples + count, silence, length - count);
+    }
+
+    usize offset = head & m_mask;
+    usize first = count < capacity() - offset ? count : capacity() - offset;
+    std::memcpy(samples, m_buffer + offset, first);
+    std::memcpy(samples + first, m_buffer, count - first);
+
+    m_head.store(head + count, std::memory_order_release);
+    return count;
+}
+
+} // namespace GB
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+
+#include "Defs.hpp"
+
+namespace GB {
+
+// Interleaved stereo frames, in the device's format, from the emulation
+// thread to the audio callback, for exactly one producer and one consumer.
+// Neither side ever waits: samples that do not fit are dropped (an
+// overrun), samples that are missing are played as silence (an underrun).
+class AudioRing {
+    public:
+        // capacity in bytes, rounded up to a power of two, moving whole
+        // frames of `frame_size` bytes, also a power of two
+        AudioRing(usize capacity, usize frame_size);
+        ~AudioRing();
+
+        AudioRing(const AudioRing&) = delete;
+        AudioRing& operator=(const AudioRing&) = delete;
+
+        // producer side, returns the number of bytes written
+        usize write(const u8* samples, usize length);
+        // consumer side, always fills `length` bytes, returns the number of
+        // bytes that were not silence
+        usize read(u8* samples, usize length, u8 silence);
+
+        inline usize capacity() const { return m_mask + 1; }
+        // bytes waiting to be read
+        inline usize fill() const
+        {
+            return m_tail.load(std::memory_order_acquire)
+                - m_head.load(std::memory_order_acquire);
+        }
+
+        inline u64 underruns() const { return m_underruns.load(std::memory_order_relaxed); }
+        inline u64 overruns() const { return m_overruns.load(std::memory_order_relaxed); }
+
+    private:
+        u8* m_buffer { nullptr };
+        usize m_mask { 0 };
+        usize m_frame_mask { 0 };
+        // each index is only written by one side
+        alignas(64) std::atomic<usize> m_head { 0 };
+        alignas(64) std::atomic<usize> m_tail { 0 };
+        alignas(64) std::atomic<u64> m_underruns { 0 };
+        std::atomic<u64> m_overruns { 0 };
+};
+
+} // namespace GB
@@ -0,0 +1,189 @@
+#include "AudioSink.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace GB {
+
+static const float FLOAT_SCALE = 1.0f / 32768.0f;
+
+// SSE2 is part of x86-64, no runtime check needed: 8 samples are sign
+// extended and converted per iteration
+void convert_samples(
+        const i16* samples,
+        usize count,
+        SampleFormat::Format format,
+        u8* out)
+{
+    if (format == SampleFormat::S16) {
+        memcpy(out, samples, count * sizeof(i16));
+        return;
+    }
+
+    auto* floats = (float*)out;
+    usize index = 0;
+#ifdef __SSE2__
+    auto scale = _mm_set1_ps(FLOAT_SCALE);
+    for (; index + 8 <= count; index += 8) {
+        auto words = _mm_loadu_si128((const __m128i*)(samples + index));
+        auto low = _mm_srai_epi32(_mm_unpacklo_epi16(words, words), 16);
+        auto high = _mm_srai_epi32(_mm_unpackhi_epi16(words, words), 16);
+        _mm_storeu_ps(floats + index, _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+        _mm_storeu_ps(floats + index + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+    }
+#endif
+    for (; index < count; ++index)
+        floats[index] = samples[index] * FLOAT_SCALE;
+}
+
+FileAudioSink::FileAudioSink(
+        const char* path,
+        Format::Container container,
+        SampleFormat::Format format,
+        u32 sample_rate)
+    : m_container(container)
+    , m_format(format)
+    , m_sample_rate(sample_rate)
+{
+    m_file = fopen(path, "wb");
+    if (!m_file) {
+        fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+        exit(-1);
+    }
+
+    for (auto& chunk : m_chunks) {
+        chunk.data = (u8*)malloc(CHUNK_SIZE);
+        assert(chunk.data);
+    }
+
+    // sizes are filled in on close
+    if (m_container == Format::WAV)
+        write_header(0);
+
+    m_writer = std::thread(&FileAudioSink::writer_loop, this);
+}
+
+FileAudioSink::~FileAudioSink()
+{
+    if (m_chunks[m_filling].size)
+        queue_chunk();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closing = true;
+    }
+    m_changed.notify_all();
+    m_writer.join();
+
+    if (m_container == Format::WAV) {
+        fseek(m_file, 0, SEEK_SET);
+        write_header(m_written);
+    }
+    fclose(m_file);
+
+    for (auto& chunk : m_chunks)
+        free(chunk.data);
+}
+
+void FileAudioSink::write(const i16* samples, usize length)
+{
+    usize size = sample_size(m_format);
+    while (length) {
+        auto& chunk = m_chunks[m_filling];
+        usize space = (CHUNK_SIZE - chunk.size) / size;
+        usize count = length < space ? length : space;
+
+        convert_samples(samples, count, m_format, chunk.data + chunk.size);
+        chunk.size += count * size;
+        m_written += count * size;
+        samples += count;
+        length -= count;
+
+        if (chunk.size == CHUNK_SIZE)
+            queue_chunk();
+    }
+}
+
+// Hands the filling chunk to the writer, then waits for the next one to be
+// free
+void FileAudioSink::queue_chunk()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    ++m_queued;
+    m_changed.notify_all();
+
+    m_filling = (m_filling + 1) % CHUNK_COUNT;
+    m_changed.wait(lock, [this] { return m_queued < CHUNK_COUNT; });
+}
+
+void FileAudioSink::writer_loop()
+{
+    usize next = 0;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_changed.wait(lock, [this] { return m_queued || m_closing; });
+        if (!m_queued)
+            return;
+
+        auto& chunk = m_chunks[next];
+        lock.unlock();
+        if (fwrite(chunk.data, 1, chunk.size, m_file) != chunk.size) {
+            fprintf(stderr, "Could not write audio: %s\n", strerror(errno));
+            exit(-1);
+        }
+        chunk.size = 0;
+        next = (next + 1) % CHUNK_COUNT;
+        lock.lock();
+
+        --m_queued;
+        m_changed.notify_all();
+    }
+}
+
+static void put_u16(u8* out, u16 value)
+{
+    out[0] = value & 0xff;
+    out[1] = value >> 8;
+}
+
+static void put_u32(u8* out, u32 value)
+{
+    put_u16(out, value & 0xffff);
+    put_u16(out + 2, value >> 16);
+}
+
+// RIFF/WAVE with a single data chunk, 16-bit PCM or 32-bit float stereo
+void FileAudioSink::write_header(u64 data_size)
+{
+    static const u16 CHANNELS = 2;
+    static const u16 PCM = 1;
+    static const u16 IEEE_FLOAT = 3;
+    u16 bits = sample_size(m_format) * 8;
+
+    u8 header[44];
+    memcpy(header, "RIFF", 4);
+    put_u32(header + 4, (u32)(36 + data_size));
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put_u32(header + 16, 16);
+    put_u16(header + 20, m_format == SampleFormat::F32 ? IEEE_FLOAT : PCM);
+    put_u16(header + 22, CHANNELS);
+    put_u32(header + 24, m_sample_rate);
+    put_u32(header + 28, m_sample_rate * CHANNELS * bits / 8);
+    put_u16(header + 32, CHANNELS * bits / 8);
+    put_u16(header + 34, bits);
+    memcpy(header + 36, "data", 4);
+    put_u32(header + 40, (u32)data_size);
+
+    if (fwrite(header, sizeof(header), 1, m_file) != 1) {
+        fprintf(stderr, "Could not write audio: %s\n", strerror(errno));
+        exit(-1);
+    }
+}
+
+} // namespace GB
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+#include "Defs.hpp"
+
+namespace GB {
+
+struct SampleFormat {
+    enum Format {
+        S16,
+        F32,
+    };
+};
+
+inline usize sample_size(SampleFormat::Format format)
+{
+    return format == SampleFormat::F32 ? sizeof(float) : sizeof(i16);
+}
+
+// Writes `count` samples in `format` to `out`, floats spanning -1 to 1
+void convert_samples(
+        const i16* samples,
+        usize count,
+        SampleFormat::Format format,
+        u8* out);
+
+// Where the APU sends its samples: blocks of interleaved stereo 16-bit
+// samples, written from the emulation thread. The APU produces them at
+// sample_rate(), which a sink may move slightly while running to follow
+// its own clock. A sink that does not want samples at all spares the APU
+// the mixing.
+class AudioSink {
+    public:
+        virtual ~AudioSink() = default;
+
+        virtual double sample_rate() const = 0;
+        virtual void write(const i16* samples, usize length) = 0;
+        virtual bool wants_samples() const { return true; }
+
+        virtual void pause() {}
+        virtual void unpause() {}
+};
+
+// Discards everything, nothing is mixed.
+class NullAudioSink : public AudioSink {
+    public:
+        double sample_rate() const override { return 44100.0; }
+        void write(const i16*, usize) override {}
+        bool wants_samples() const override { return false; }
+};
+
+// Streams the samples to a file, as fast as they come: a WAV file, or raw
+// PCM for `ffmpeg -f s16le|f32le -ac 2 -ar RATE`. Samples are gathered into
+// large chunks written out by a background thread, the emulation only
+// waits when the disk falls behind by every chunk.
+class FileAudioSink : public AudioSink {
+    public:
+        struct Format {
+            enum Container {
+                WAV,
+                RAW,
+            };
+        };
+
+        FileAudioSink(
+                const char* path,
+                Format::Container,
+                SampleFormat::Format,
+                u32 sample_rate);
+        ~FileAudioSink();
+
+        FileAudioSink(const FileAudioSink&) = delete;
+        FileAudioSink& operator=(const FileAudioSink&) = delete;
+
+        double sample_rate() const override { return m_sample_rate; }
+        void write(const i16* samples, usize length) override;
+
+        // bytes of samples written so far
+        inline u64 written() const { return m_written; }
+
+    private:
+        static const usize CHUNK_SIZE = 1 << 18;
+        static const usize CHUNK_COUNT = 4;
+
+        struct Chunk {
+            u8* data { nullptr };
+            usize size { 0 };
+        };
+
+        FILE* m_file { nullptr };
+        Format::Container m_container;
+        SampleFormat::Format m_format;
+        u32 m_sample_rate;
+        u64 m_written { 0 };
+
+        // chunks go from the emulation thread to the writer and back, in
+        // order, `m_queued` of them being with the writer
+        Chunk m_chunks[CHUNK_COUNT];
+        usize m_filling { 0 };
+        usize m_queued { 0 };
+        bool m_closing { false };
+        std::mutex m_mutex;
+        std::condition_variable m_changed;
+        std::thread m_writer;
+
+        void queue_chunk();
+        void writer_loop();
+        void write_header(u64 data_size);
+};
+
+} // namespace GB
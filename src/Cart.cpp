@@ -1,6 +1,9 @@
 #include <cassert>
+#include <cstring>
+#include <ctime>
 
 #include "Cart.hpp"
+#include "Log.hpp"
 
 namespace GB {
 
@@ -236,6 +239,32 @@ bool CartHeader::has_ram() const
     }
 }
 
+bool CartHeader::has_battery() const
+{
+    switch (m_header->cart_type) {
+        case 0x03:
+        case 0x06:
+        case 0x09:
+        case 0x0d:
+        case 0x0f:
+        case 0x10:
+        case 0x13:
+        case 0x1b:
+        case 0x1e:
+        case 0x22:
+        case 0xff:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+bool CartHeader::has_rtc() const
+{
+    return m_header->cart_type == 0x0f || m_header->cart_type == 0x10;
+}
+
 bool CartHeader::checksum_header() const
 {
     u8 checksum = 0;
@@ -248,18 +277,73 @@ bool CartHeader::checksum_header() const
     return checksum == m_header->header_checksum;
 }
 
-Cart::Cart(const u8* data)
-    : m_data(data)
-    , m_header(data)
+static u8* copy_rom(const u8* data, usize size, usize* padded_size)
+{
+    static const usize HEADER_END = 0x150;
+    if (size < HEADER_END) {
+        fprintf(stderr, "rom is too small to hold a header (%ld bytes)\n", size);
+        exit(-1);
+    }
+
+    // the MBCs trust the header size: pad short dumps with open bus
+    usize rom_size = CartHeader(data).rom_size();
+    *padded_size = rom_size > size ? rom_size : size;
+
+    auto* copy = (u8*)malloc(*padded_size);
+    assert(copy);
+    memcpy(copy, data, size);
+    memset(copy + size, 0xff, *padded_size - size);
+    return copy;
+}
+
+RomImage::RomImage(const u8* data, usize size)
+    : m_data(copy_rom(data, size, &m_size))
+    , m_header(m_data)
+{
+}
+
+RomImage::~RomImage()
+{
+    free(m_data);
+}
+
+std::shared_ptr<const RomImage> RomImage::load(const char* filename)
 {
-    m_mbc = MemoryBankController::create(data);
+    auto file = fopen(filename, "rb");
+    if (!file) {
+        perror(filename);
+        exit(-1);
+    }
 
-    printf("Loaded cartridge [%s]\n", m_header.title().c_str());
-    printf("Memory Bank Controller: %s\n", MBCTypeName(m_header.mbc_type()));
-    printf("ROM size: %ld\n", m_header.rom_size());
-    printf("RAM size: %ld\n", m_header.ram_size());
+    fseek(file, 0, SEEK_END);
+    auto size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    auto* data = (u8*)malloc(size);
+    if (!fread(data, size, 1, file)) {
+        perror(filename);
+        fclose(file);
+        exit(-1);
+    }
+    fclose(file);
+
+    auto image = std::make_shared<const RomImage>(data, (usize)size);
+    free(data);
+    return image;
+}
+
+Cart::Cart(std::shared_ptr<const RomImage> rom, const SaveOptions& save_options)
+    : m_rom(std::move(rom))
+{
+    m_mbc = MemoryBankController::create(m_rom->data(), save_options);
 
-    if (m_header.checksum_header()) {
+    auto& header = m_rom->header();
+    printf("Loaded cartridge [%s]\n", header.title().c_str());
+    printf("Memory Bank Controller: %s\n", MBCTypeName(header.mbc_type()));
+    printf("ROM size: %ld\n", header.rom_size());
+    printf("RAM size: %ld\n", header.ram_size());
+
+    if (header.checksum_header()) {
         printf("Checksum valid! :)\n");
     } else {
         printf("Checksum invalid! :(\n");
@@ -271,20 +355,29 @@ Cart::~Cart()
     delete m_mbc;
 }
 
-MemoryBankController* MemoryBankController::create(const u8* data) {
-    auto mbc_type = CartHeader(data).mbc_type();
+MemoryBankController* MemoryBankController::create(
+        const u8* data,
+        const SaveOptions& save_options)
+{
+    CartHeader header(data);
+    auto mbc_type = header.mbc_type();
+
+    // only battery-backed RAM survives power off
+    SaveOptions options = save_options;
+    if (!header.has_battery())
+        options.path.clear();
 
     switch (mbc_type) {
         case MBCTypes::NO_BANKING:
-            return new NoBanking(data);
+            return new NoBanking(data, options);
         case MBCTypes::MBC1:
-            return new MBC1(data);
+            return new MBC1(data, options);
         case MBCTypes::MBC2:
-            return new MBC2(data);
+            return new MBC2(data, options);
         case MBCTypes::MBC3:
-            return new MBC3(data);
+            return new MBC3(data, options);
         case MBCTypes::MBC5:
-            return new MBC5(data);
+            return new MBC5(data, options);
 
         default:
             fprintf(
@@ -296,23 +389,37 @@ MemoryBankController* MemoryBankController::create(const u8* data) {
     }
 }
 
-NoBanking::NoBanking(const u8* data)
+static usize header_ram_size(const u8* data)
+{
+    CartHeader header(data);
+    if (!header.has_ram())
+        return 0;
+
+    assert(header.ram_size() > 0);
+    return header.ram_size();
+}
+
+NoBanking::NoBanking(const u8* data, const SaveOptions& save_options)
+    : NoBanking(data, save_options, header_ram_size(data))
+{
+}
+
+NoBanking::NoBanking(
+        const u8* data,
+        const SaveOptions& save_options,
+        usize ram_size,
+        usize trailer_size)
     : m_rom(data)
+    , m_ram_size(ram_size)
+    , m_save_ram(ram_size + trailer_size, save_options)
 {
     CartHeader header(data);
     m_rom_size = header.rom_size();
-
-    if (header.has_ram()) {
-        m_ram_size = header.ram_size();
-        assert(m_ram_size > 0);
-        m_ram = (u8*)malloc(m_ram_size);
-    }
+    m_ram = m_save_ram.data();
 }
 
 NoBanking::~NoBanking()
 {
-    if (m_ram)
-        free(m_ram);
 }
 
 u8 NoBanking::read8_rom(u16 address)
@@ -332,9 +439,8 @@ u8 NoBanking::read8_ram(u16 offset)
 
 void NoBanking::write8_rom(u16 address, u8 value)
 {
-    fprintf(
-            stderr,
-            "tried writing %#02x at no-banking ROM address %#04x\n",
+    LOG_WARNING(
+            "tried writing {:#04x} at no-banking ROM address {:#06x}",
             value,
             address
            );
@@ -342,11 +448,20 @@ void NoBanking::write8_rom(u16 address, u8 value)
 
 void NoBanking::write8_ram(u16 offset, u8 value)
 {
+    if (offset >= m_ram_size)
+        return;
+
     m_ram[offset] = value;
+    m_save_ram.mark_dirty(offset);
+}
+
+MBC1::MBC1(const u8* data, const SaveOptions& save_options)
+    : MBC1(data, save_options, 0)
+{
 }
 
-MBC1::MBC1(const u8* data)
-    : NoBanking(data)
+MBC1::MBC1(const u8* data, const SaveOptions& save_options, usize trailer_size)
+    : NoBanking(data, save_options, header_ram_size(data), trailer_size)
 {
     CartHeader header(data);
 
@@ -448,15 +563,15 @@ void MBC1::write8_ram(u16 offset, u8 value)
             offset,  value);
 #endif
     m_ram[address] = value;
+    m_save_ram.mark_dirty(address);
 }
 
-MBC2::MBC2(const u8* data)
-    : NoBanking(data)
+MBC2::MBC2(const u8* data, const SaveOptions& save_options)
+    : NoBanking(data, save_options, RAM_SIZE)
 {
     CartHeader header(data);
 
     m_rom_bank_mask = header.rom_bank_mask();
-    m_ram = (u8*)realloc(m_ram, 512);
 }
 
 MBC2::~MBC2()
@@ -522,11 +637,18 @@ void MBC2::write8_ram(u16 offset, u8 value)
     if (offset >= RAM_SIZE)
         return;
     m_ram[offset] = value & 0x0f;
+    m_save_ram.mark_dirty(offset);
 }
 
-MBC3::MBC3(const u8* data)
-    : MBC1(data)
+MBC3::MBC3(const u8* data, const SaveOptions& save_options)
+    : MBC1(
+            data,
+            save_options,
+            CartHeader(data).has_rtc() ? RTC_SAVE_SIZE : 0)
 {
+    m_has_rtc = CartHeader(data).has_rtc();
+    if (m_has_rtc)
+        load_rtc();
 }
 
 MBC3::~MBC3()
@@ -556,8 +678,10 @@ void MBC3::write8_rom(u16 offset, u8 value)
         return;
     }
 
-    if (offset < 0x8000) {
-        fprintf(stderr, "implement MBC3 Latch Clock Data\n");
+    if (offset < 0x8000) { // Latch Clock Data, on a 0x00 -> 0x01 sequence
+        if (m_rtc_latch_armed && value == 0x01 && m_has_rtc)
+            latch_rtc();
+        m_rtc_latch_armed = value == 0x00;
         return;
     }
 
@@ -576,13 +700,17 @@ u8 MBC3::read8_ram(u16 offset)
         case 0x03:
             return MBC1::read8_ram(offset);
 
+        case 0x08:
+        case 0x09:
+        case 0x0a:
+        case 0x0b:
+        case 0x0c:
+            if (!m_has_rtc)
+                return 0xff;
+            return m_rtc_latched[m_ram_bank - 0x08];
+
         default:
-            fprintf(
-                    stderr,
-                    "implement RTC register 0x%02x read\n",
-                    (u8)(m_ram_bank & 0xff)
-                   );
-            return 0x00;
+            assert(false); // unreachable
     }
 }
 
@@ -599,18 +727,160 @@ void MBC3::write8_ram(u16 offset, u8 value)
             MBC1::write8_ram(offset, value);
             return;
 
-        default:
-            fprintf(
-                    stderr,
-                    "implement RTC register 0x%02x write\n",
-                    (u8)(m_ram_bank & 0xff)
-                   );
+        case 0x08:
+        case 0x09:
+        case 0x0a:
+        case 0x0b:
+        case 0x0c:
+            if (m_has_rtc)
+                write_rtc(m_ram_bank - 0x08, value);
             return;
+
+        default:
+            assert(false); // unreachable
+    }
+}
+
+static i64 host_time()
+{
+    return (i64)std::time(nullptr);
+}
+
+static u64 load_le(const u8* data, usize size)
+{
+    u64 value = 0;
+    for (usize index = 0; index < size; ++index)
+        value |= (u64)data[index] << (8 * index);
+    return value;
+}
+
+static void store_le(u8* data, usize size, u64 value)
+{
+    for (usize index = 0; index < size; ++index)
+        data[index] = (u8)(value >> (8 * index));
+}
+
+static i64 rtc_fields_to_seconds(const u8* registers)
+{
+    i64 days = (i64)registers[3] | ((i64)(registers[4] & 0x01) << 8);
+    return (i64)registers[0]
+        + (i64)registers[1] * 60
+        + (i64)registers[2] * 3600
+        + days * 86400;
+}
+
+i64 MBC3::rtc_seconds()
+{
+    if (m_rtc_halted)
+        return m_rtc_halted_seconds;
+
+    i64 seconds = host_time() - m_rtc_base;
+    if (seconds < 0) { // host clock went backwards
+        m_rtc_base = host_time();
+        seconds = 0;
     }
+
+    // the day counter overflowed: wrap it and set the carry bit
+    i64 wrap = RTC_DAYS_WRAP * 86400;
+    if (seconds >= wrap) {
+        m_rtc_base += (seconds / wrap) * wrap;
+        seconds %= wrap;
+        m_rtc_carry = true;
+    }
+    return seconds;
+}
+
+void MBC3::set_rtc_seconds(i64 seconds)
+{
+    if (m_rtc_halted)
+        m_rtc_halted_seconds = seconds;
+    else
+        m_rtc_base = host_time() - seconds;
+}
+
+void MBC3::rtc_registers(u8* registers)
+{
+    i64 seconds = rtc_seconds();
+    i64 days = seconds / 86400;
+
+    registers[0] = (u8)(seconds % 60);
+    registers[1] = (u8)((seconds / 60) % 60);
+    registers[2] = (u8)((seconds / 3600) % 24);
+    registers[3] = (u8)(days & 0xff);
+    registers[4] = (u8)((days >> 8) & 0x01)
+        | (m_rtc_halted ? 0x40 : 0)
+        | (m_rtc_carry ? 0x80 : 0);
+}
+
+void MBC3::latch_rtc()
+{
+    rtc_registers(m_rtc_latched);
+    store_rtc();
+}
+
+void MBC3::write_rtc(usize index, u8 value)
+{
+    static const u8 REGISTER_MASKS[RTC_REGISTER_COUNT] = {
+        0x3f, 0x3f, 0x1f, 0xff, 0xc1,
+    };
+
+    u8 registers[RTC_REGISTER_COUNT];
+    rtc_registers(registers);
+    registers[index] = value & REGISTER_MASKS[index];
+
+    i64 seconds = rtc_fields_to_seconds(registers);
+    m_rtc_halted = registers[4] & 0x40;
+    m_rtc_carry = registers[4] & 0x80;
+    set_rtc_seconds(seconds);
+
+    m_rtc_latched[index] = registers[index];
+    store_rtc();
+}
+
+void MBC3::load_rtc()
+{
+    const u8* save = rtc_save_area();
+    i64 timestamp = (i64)load_le(save + 40, 8);
+
+    if (timestamp == 0) { // fresh save: the clock starts now at 0
+        m_rtc_base = host_time();
+        return;
+    }
+
+    u8 registers[RTC_REGISTER_COUNT];
+    for (usize index = 0; index < RTC_REGISTER_COUNT; ++index) {
+        registers[index] = (u8)load_le(save + index * 4, 4);
+        m_rtc_latched[index] = (u8)load_le(save + 20 + index * 4, 4);
+    }
+
+    i64 seconds = rtc_fields_to_seconds(registers);
+    m_rtc_halted = registers[4] & 0x40;
+    m_rtc_carry = registers[4] & 0x80;
+    if (m_rtc_halted)
+        m_rtc_halted_seconds = seconds;
+    else
+        m_rtc_base = timestamp - seconds;
+}
+
+void MBC3::store_rtc()
+{
+    u8* save = rtc_save_area();
+    u8 registers[RTC_REGISTER_COUNT];
+    i64 now = host_time();
+    rtc_registers(registers);
+
+    for (usize index = 0; index < RTC_REGISTER_COUNT; ++index) {
+        store_le(save + index * 4, 4, registers[index]);
+        store_le(save + 20 + index * 4, 4, m_rtc_latched[index]);
+    }
+    store_le(save + 40, 8, (u64)now);
+
+    m_save_ram.mark_dirty(m_ram_size);
+    m_save_ram.mark_dirty(m_ram_size + RTC_SAVE_SIZE - 1);
 }
 
-MBC5::MBC5(const u8* data)
-    : NoBanking(data)
+MBC5::MBC5(const u8* data, const SaveOptions& save_options)
+    : NoBanking(data, save_options)
 {
     CartHeader header(data);
     m_rom_bank_mask = header.rom_bank_mask();
@@ -673,10 +943,7 @@ void MBC5::write8_rom(u16 offset, u8 value)
     }
 
     if (offset < 0x8000) {
-        fprintf(
-                stderr,
-                "WARNING: (MBC5) Writing to non-writeable ROM area 0x6000-0x7fff\n"
-               );
+        LOG_WARNING("(MBC5) writing to non-writeable ROM area 0x6000-0x7fff");
         return;
     }
 
@@ -693,6 +960,7 @@ void MBC5::write8_ram(u16 offset, u8 value)
         return;
 
     m_ram[address] = value;
+    m_save_ram.mark_dirty(address);
 }
 
 } // namespace GB
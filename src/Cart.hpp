@@ -1,8 +1,10 @@
 #pragma once
 
+#include <memory>
 #include <string>
 
 #include "Defs.hpp"
+#include "SaveRam.hpp"
 
 namespace GB {
 
@@ -40,6 +42,8 @@ class CartHeader {
         usize rom_bank_mask() const;
         usize ram_bank_count() const;
         bool has_ram() const;
+        bool has_battery() const;
+        bool has_rtc() const;
         bool checksum_header() const;
 
     private:
@@ -64,9 +68,31 @@ class CartHeader {
         const RawHeader* m_header;
 };
 
+// Immutable ROM contents, shared by every Cart (and so every Emulator)
+// running the same game. Per-instance mutable state lives in the MBC.
+class RomImage {
+    public:
+        static std::shared_ptr<const RomImage> load(const char* filename);
+
+        RomImage(const u8* data, usize size);
+        ~RomImage();
+
+        RomImage(const RomImage&) = delete;
+        RomImage& operator=(const RomImage&) = delete;
+
+        const u8* data() const { return m_data; }
+        usize size() const { return m_size; }
+        const CartHeader& header() const { return m_header; }
+
+    private:
+        u8* m_data { nullptr };
+        usize m_size { 0 };
+        CartHeader m_header;
+};
+
 class MemoryBankController {
     public:
-        static MemoryBankController* create(const u8*);
+        static MemoryBankController* create(const u8*, const SaveOptions&);
 
         virtual ~MemoryBankController() {}
 
@@ -78,7 +104,7 @@ class MemoryBankController {
 
 class NoBanking : public MemoryBankController {
     public:
-        explicit NoBanking(const u8*);
+        NoBanking(const u8*, const SaveOptions&);
         ~NoBanking();
 
         virtual u8 read8_rom(u16) override;
@@ -87,15 +113,23 @@ class NoBanking : public MemoryBankController {
         virtual void write8_ram(u16, u8) override;
 
     protected:
+        // trailer_size bytes are kept after the RAM in the save file
+        NoBanking(
+                const u8*,
+                const SaveOptions&,
+                usize ram_size,
+                usize trailer_size = 0);
+
         const u8* m_rom;
         usize m_rom_size { 0 };
         usize m_ram_size { 0 };
+        SaveRam m_save_ram;
         u8* m_ram { nullptr };
 };
 
 class MBC1 : public NoBanking {
     public:
-        explicit MBC1(const u8*);
+        MBC1(const u8*, const SaveOptions&);
         ~MBC1();
 
         virtual u8 read8_rom(u16) override;
@@ -104,6 +138,8 @@ class MBC1 : public NoBanking {
         virtual void write8_ram(u16, u8) override;
 
     protected:
+        MBC1(const u8*, const SaveOptions&, usize trailer_size);
+
         inline usize rom_bank_base() { return m_rom_bank * ROM_BANK_SIZE; }
         inline usize ram_bank_base() { return m_ram_bank * RAM_BANK_SIZE; }
 
@@ -121,7 +157,7 @@ class MBC1 : public NoBanking {
 
 class MBC2 : public NoBanking {
     public:
-        explicit MBC2(const u8*);
+        MBC2(const u8*, const SaveOptions&);
         ~MBC2();
 
         virtual u8 read8_rom(u16) override;
@@ -140,7 +176,7 @@ class MBC2 : public NoBanking {
 
 class MBC3 : public MBC1 {
     public:
-        explicit MBC3(const u8*);
+        MBC3(const u8*, const SaveOptions&);
         ~MBC3();
 
         virtual u8 read8_ram(u16) override;
@@ -148,11 +184,35 @@ class MBC3 : public MBC1 {
         virtual void write8_ram(u16, u8) override;
 
     private:
+        // Seconds, Minutes, Hours, Days low, Days high
+        static const usize RTC_REGISTER_COUNT = 5;
+        // 5 current + 5 latched registers as u32, then a u64 UNIX timestamp
+        static const usize RTC_SAVE_SIZE = 48;
+        static const i64 RTC_DAYS_WRAP = 512;
+
+        // The clock is never ticked: its value is derived from the host time
+        // whenever it is latched or written.
+        bool m_has_rtc { false };
+        bool m_rtc_latch_armed { false };
+        bool m_rtc_halted { false };
+        bool m_rtc_carry { false };
+        i64 m_rtc_base { 0 };
+        i64 m_rtc_halted_seconds { 0 };
+        u8 m_rtc_latched[RTC_REGISTER_COUNT] {};
+
+        inline u8* rtc_save_area() { return m_ram + m_ram_size; }
+        i64 rtc_seconds();
+        void set_rtc_seconds(i64);
+        void rtc_registers(u8*);
+        void latch_rtc();
+        void write_rtc(usize, u8);
+        void load_rtc();
+        void store_rtc();
 };
 
 class MBC5 : public NoBanking {
     public:
-        explicit MBC5(const u8*);
+        MBC5(const u8*, const SaveOptions&);
         ~MBC5();
 
         virtual u8 read8_rom(u16) override;
@@ -172,23 +232,21 @@ class MBC5 : public NoBanking {
 
 class Cart {
     public:
-        explicit Cart(const u8* data);
+        explicit Cart(std::shared_ptr<const RomImage>, const SaveOptions& = {});
         ~Cart();
 
-        const u8* data() const { return m_data; }
+        const RomImage& rom() const { return *m_rom; }
+        const u8* data() const { return m_rom->data(); }
 
         u8 read8_rom(u16 address) { return m_mbc->read8_rom(address); }
         void write8_rom(u16 address, u8 value) { m_mbc->write8_rom(address, value); }
         u8 read8_ram(u16 address) { return m_mbc->read8_ram(address); }
         void write8_ram(u16 address, u8 value) { m_mbc->write8_ram(address, value); }
 
-        const CartHeader& header() const { return m_header; }
-
-        //const u8* data() const { return m_head
+        const CartHeader& header() const { return m_rom->header(); }
 
     private:
-        const u8* m_data;
-        CartHeader m_header;
+        std::shared_ptr<const RomImage> m_rom;
         MemoryBankController* m_mbc;
 };
 
@@ -0,0 +1,111 @@
+#include "DeltaBuffer.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace GB {
+
+i16 DeltaBuffer::s_kernel[1 << PHASE_BITS][KERNEL_TAPS];
+
+// A Blackman-windowed sinc cut off a little below Nyquist, one row per
+// phase. Every row sums to exactly 1 << KERNEL_BITS so a step integrates to
+// its delta, whatever its phase.
+bool DeltaBuffer::build_kernel()
+{
+    static const double CUTOFF = 0.45;
+    static const usize PHASES = 1 << PHASE_BITS;
+
+    for (usize phase = 0; phase < PHASES; ++phase) {
+        double fraction = (double)phase / PHASES;
+        double values[KERNEL_TAPS];
+        double sum = 0.0;
+        for (usize tap = 0; tap < KERNEL_TAPS; ++tap) {
+            double x = (double)tap - (KERNEL_TAPS / 2 - 1) - fraction;
+            double angle = M_PI * x / (KERNEL_TAPS / 2);
+            double window = 0.42 + 0.5 * cos(angle) + 0.08 * cos(2 * angle);
+            double sinc = x == 0.0
+                ? 1.0
+                : sin(2 * M_PI * CUTOFF * x) / (2 * M_PI * CUTOFF * x);
+            values[tap] = sinc * window;
+            sum += values[tap];
+        }
+
+        i32 total = 0;
+        usize largest = 0;
+        for (usize tap = 0; tap < KERNEL_TAPS; ++tap) {
+            s_kernel[phase][tap] = (i16)lround(values[tap] / sum * (1 << KERNEL_BITS));
+            total += s_kernel[phase][tap];
+            if (values[tap] > values[largest])
+                largest = tap;
+        }
+        s_kernel[phase][largest] += (1 << KERNEL_BITS) - total;
+    }
+    return true;
+}
+
+DeltaBuffer::DeltaBuffer(u32 clock_rate, u32 sample_rate, usize capacity)
+    : m_capacity(capacity)
+{
+    // built once, by whichever instance comes first on whatever thread
+    static const bool kernel_built = build_kernel();
+    (void)kernel_built;
+
+    m_buffer = (i32*)malloc((m_capacity + KERNEL_TAPS) * sizeof(i32));
+    assert(m_buffer);
+    set_rates(clock_rate, sample_rate);
+    clear();
+}
+
+DeltaBuffer::~DeltaBuffer()
+{
+    free(m_buffer);
+}
+
+void DeltaBuffer::set_rates(u32 clock_rate, double sample_rate)
+{
+    m_factor = (u64)(sample_rate / clock_rate * ((u64)1 << FRACTION_BITS) + 0.5);
+}
+
+void DeltaBuffer::end_block(u32 clocks)
+{
+    m_offset += clocks * m_factor;
+    assert(samples_available() <= m_capacity);
+}
+
+usize DeltaBuffer::read_samples(i16* out, usize count, usize stride)
+{
+    usize available = samples_available();
+    if (count > available)
+        count = available;
+
+    i32 integrator = m_integrator;
+    for (usize index = 0; index < count; ++index) {
+        integrator += m_buffer[index];
+        i32 sample = integrator >> KERNEL_BITS;
+        if (sample > INT16_MAX)
+            sample = INT16_MAX;
+        else if (sample < INT16_MIN)
+            sample = INT16_MIN;
+        out[index * stride] = (i16)sample;
+        integrator -= sample * (1 << (KERNEL_BITS - BASS_SHIFT));
+    }
+    m_integrator = integrator;
+
+    // what the kernels spilled past the samples read moves to the front
+    usize remaining = available - count + KERNEL_TAPS;
+    std::memmove(m_buffer, m_buffer + count, remaining * sizeof(i32));
+    std::memset(m_buffer + remaining, 0, count * sizeof(i32));
+    m_offset -= (u64)count << FRACTION_BITS;
+    return count;
+}
+
+void DeltaBuffer::clear()
+{
+    m_offset = 0;
+    m_integrator = 0;
+    std::memset(m_buffer, 0, (m_capacity + KERNEL_TAPS) * sizeof(i32));
+}
+
+} // namespace GB
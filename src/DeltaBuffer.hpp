@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Defs.hpp"
+
+namespace GB {
+
+// Band-limited synthesis of a stepped signal. Steps are added as amplitude
+// deltas at their clock time, each spread over KERNEL_TAPS samples by a
+// windowed sinc picked by the sub-sample phase. Reading integrates the
+// deltas back into samples, with a slight leak that removes the DC offset
+// like the capacitor on the real output.
+//
+// Time is counted in clocks from the start of the current block; closing
+// the block makes its samples readable.
+class DeltaBuffer {
+    public:
+        static const usize KERNEL_TAPS = 16;
+        static const usize PHASE_BITS = 5;
+        static const usize KERNEL_BITS = 15;
+
+        // capacity in samples, per block
+        DeltaBuffer(u32 clock_rate, u32 sample_rate, usize capacity);
+        ~DeltaBuffer();
+
+        DeltaBuffer(const DeltaBuffer&) = delete;
+        DeltaBuffer& operator=(const DeltaBuffer&) = delete;
+
+        // The sample rate need not be whole, it can be nudged to follow
+        // another clock
+        void set_rates(u32 clock_rate, double sample_rate);
+
+        inline void add_delta(u32 time, i32 delta)
+        {
+            u64 position = m_offset + time * m_factor;
+            usize index = position >> FRACTION_BITS;
+            usize phase = (position >> (FRACTION_BITS - PHASE_BITS))
+                & ((1 << PHASE_BITS) - 1);
+
+            auto* out = m_buffer + index;
+            auto* kernel = s_kernel[phase];
+            for (usize tap = 0; tap < KERNEL_TAPS; ++tap)
+                out[tap] += kernel[tap] * delta;
+        }
+
+        void end_block(u32 clocks);
+        inline usize samples_available() const { return m_offset >> FRACTION_BITS; }
+        // Reads up to `count` samples, `stride` apart in `out`
+        usize read_samples(i16* out, usize count, usize stride);
+        void clear();
+
+    private:
+        static const usize FRACTION_BITS = 32;
+        static const usize BASS_SHIFT = 9;
+
+        static i16 s_kernel[1 << PHASE_BITS][KERNEL_TAPS];
+        static bool build_kernel();
+
+        // sample position of one clock, and of the block start, with
+        // FRACTION_BITS fractional bits
+        u64 m_factor { 0 };
+        u64 m_offset { 0 };
+        i32* m_buffer { nullptr };
+        usize m_capacity { 0 };
+        i32 m_integrator { 0 };
+};
+
+} // namespace GB
@@ -1,14 +1,17 @@
 #include "Emulator.hpp"
 
-#include <SDL2/SDL.h>
-
 namespace GB {
 
-Emulator::Emulator(Cart* cart, SDL_Texture* screen)
+// Everything an instance mutates lives in this block, apart from the
+// framebuffer, the audio buffers and the cartridge RAM. The ROM and
+// what is derived from it are shared through RomImage.
+static_assert(sizeof(Emulator) < 64 * KB, "Emulator state outgrew 64 KB");
+
+Emulator::Emulator(Cart* cart, FrameSink* frame_sink, AudioSink* audio_sink)
     : m_mmu(*this, cart)
     , m_cpu(*this)
-    , m_ppu(*this, screen)
-    , m_apu(*this)
+    , m_ppu(*this, frame_sink)
+    , m_apu(*this, audio_sink)
     , m_joypad(*this)
     , m_timer(*this)
 {
@@ -57,9 +60,27 @@ void Emulator::step()
 void Emulator::exec_to_next_frame()
 {
     m_frame_end = false;
-    while (!m_frame_end) {
+    m_break_requested = false;
+    while (!m_frame_end && !m_break_requested) {
         m_cpu.cycle();
     }
 }
 
+void Emulator::exec_for(u64 cycles)
+{
+    m_break_requested = false;
+    u64 end = m_cpu.cycles() + cycles;
+    while (m_cpu.cycles() < end && !m_break_requested) {
+        m_cpu.cycle();
+    }
+}
+
+void Emulator::notify_breakpoint(AccessKind::Kind kind, u16 address, u8 value)
+{
+    if (!m_breakpoint_callback)
+        return;
+
+    m_breakpoint_callback({ kind, address, value, m_cpu.cycles() });
+}
+
 }
@@ -9,16 +9,31 @@
 #include "Timer.hpp"
 #include "APU.hpp"
 
-#include <SDL2/SDL.h>
+#include <functional>
 
 namespace GB {
 
+struct BreakpointHit {
+    AccessKind::Kind kind;
+    u16 address;
+    u8 value;
+    // T-cycles since power on
+    u64 cycle;
+};
+
+typedef std::function<void(const BreakpointHit&)> BreakpointCallback;
+
 class Emulator {
     public:
-        Emulator(Cart*, SDL_Texture*);
+        // frames and samples go to the sinks, nullptr to not render or mix
+        // at all
+        Emulator(Cart*, FrameSink*, AudioSink*);
 
         void step();
+        // both return early when a breakpoint callback requests a break
         void exec_to_next_frame();
+        // runs at least `cycles` T-cycles, to the end of an instruction
+        void exec_for(u64 cycles);
 
         inline LR35902& cpu() { return m_cpu; }
         inline MemoryMapper& mmu() { return m_mmu; }
@@ -27,10 +42,32 @@ class Emulator {
         inline Joypad& joypad() { return m_joypad; }
         inline Timer& timer() { return m_timer; }
 
+        // a disabled PPU is never clocked: no frames, no LCD interrupts
+        inline bool ppu_enabled() const { return m_ppu_enabled; }
+        inline void set_ppu_enabled(bool value) { m_ppu_enabled = value; }
+
         inline bool trace() const { return m_trace; }
         inline void enable_tracing(bool value) { m_trace = value; }
 
         void notify_frame_end() { m_frame_end = true; }
+        // the frame that just ended is identical to the previous one
+        inline bool frame_unchanged() const { return m_ppu.frame_unchanged(); }
+
+        inline void add_breakpoint(u16 address, u8 kinds)
+        {
+            m_mmu.add_watchpoint(address, kinds);
+        }
+        inline void remove_breakpoint(u16 address, u8 kinds)
+        {
+            m_mmu.remove_watchpoint(address, kinds);
+        }
+        inline void set_breakpoint_callback(BreakpointCallback callback)
+        {
+            m_breakpoint_callback = std::move(callback);
+        }
+        void notify_breakpoint(AccessKind::Kind, u16 address, u8 value);
+        inline void request_break() { m_break_requested = true; }
+        inline bool break_requested() const { return m_break_requested; }
 
     private:
         MemoryMapper m_mmu;
@@ -41,7 +78,10 @@ class Emulator {
         Timer m_timer;
 
         bool m_frame_end { false };
+        bool m_ppu_enabled { true };
         bool m_trace { false };
+        bool m_break_requested { false };
+        BreakpointCallback m_breakpoint_callback {};
 };
 
 }
@@ -0,0 +1,118 @@
+#include "FrameSink.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace GB {
+
+static const usize FRAME_SIZE = SCREEN_WIDTH * SCREEN_HEIGHT * sizeof(u32);
+
+static u32* allocate_frame()
+{
+    auto* frame = (u32*)aligned_alloc(64, FRAME_SIZE);
+    assert(frame);
+    memset(frame, 0, FRAME_SIZE);
+    return frame;
+}
+
+MemoryFrameSink::MemoryFrameSink()
+{
+    m_buffers[0] = allocate_frame();
+    m_buffers[1] = allocate_frame();
+}
+
+MemoryFrameSink::~MemoryFrameSink()
+{
+    free(m_buffers[0]);
+    free(m_buffers[1]);
+}
+
+FrameSpan MemoryFrameSink::begin_frame()
+{
+    return { m_buffers[m_front ^ 1], SCREEN_WIDTH };
+}
+
+void MemoryFrameSink::end_frame(const FrameSpan&)
+{
+    m_front ^= 1;
+    ++m_frame_count;
+}
+
+FileFrameSink::FileFrameSink(const char* path)
+{
+    m_file = fopen(path, "wb");
+    if (!m_file) {
+        fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+        exit(-1);
+    }
+    m_buffer = allocate_frame();
+}
+
+FileFrameSink::~FileFrameSink()
+{
+    fclose(m_file);
+    free(m_buffer);
+}
+
+FrameSpan FileFrameSink::begin_frame()
+{
+    return { m_buffer, SCREEN_WIDTH };
+}
+
+void FileFrameSink::end_frame(const FrameSpan& frame)
+{
+    if (fwrite(frame.pixels, FRAME_SIZE, 1, m_file) != 1) {
+        fprintf(stderr, "Could not write frame: %s\n", strerror(errno));
+        exit(-1);
+    }
+}
+
+// the buffer still holds the previous frame
+void FileFrameSink::repeat_frame()
+{
+    end_frame({ m_buffer, SCREEN_WIDTH });
+}
+
+TripleBufferSink::TripleBufferSink()
+{
+    for (auto*& buffer : m_buffers)
+        buffer = allocate_frame();
+}
+
+TripleBufferSink::~TripleBufferSink()
+{
+    for (auto* buffer : m_buffers)
+        free(buffer);
+}
+
+FrameSpan TripleBufferSink::begin_frame()
+{
+    return { m_buffers[m_back], SCREEN_WIDTH };
+}
+
+void TripleBufferSink::end_frame(const FrameSpan&)
+{
+    u8 previous = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel);
+    if (previous & FRESH)
+        m_dropped_frames.fetch_add(1, std::memory_order_relaxed);
+    m_back = previous & ~FRESH;
+}
+
+bool TripleBufferSink::acquire(FrameSpan& frame)
+{
+    bool fresh = m_middle.load(std::memory_order_relaxed) & FRESH;
+    if (fresh) {
+        u8 previous = m_middle.exchange(m_front, std::memory_order_acq_rel);
+        m_front = previous & ~FRESH;
+        m_acquired_any = true;
+    } else if (m_acquired_any) {
+        m_repeated_frames.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    frame = { m_buffers[m_front], SCREEN_WIDTH };
+    return fresh;
+}
+
+} // namespace GB
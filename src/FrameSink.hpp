@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+
+#include "Defs.hpp"
+
+namespace GB {
+
+static const usize SCREEN_WIDTH = 160;
+static const usize SCREEN_HEIGHT = 144;
+
+// A frame in the sink's own memory: SCREEN_HEIGHT rows of XBGR8888 pixels
+// (R in the low byte), `pitch` pixels apart. Frames are passed around as
+// spans, never copied.
+struct FrameSpan {
+    u32* pixels { nullptr };
+    usize pitch { 0 };
+
+    inline u32* line(usize y) const { return pixels + y * pitch; }
+};
+
+// Where the PPU draws. begin_frame is called before the first line of a
+// frame is rendered, end_frame at VBlank with the same span. A sink that
+// returns an empty span gets no pixels at all and rendering is skipped.
+// A frame identical to the previous one is not drawn: only repeat_frame is
+// called at VBlank.
+class FrameSink {
+    public:
+        virtual ~FrameSink() = default;
+
+        virtual FrameSpan begin_frame() = 0;
+        virtual void end_frame(const FrameSpan&) = 0;
+        virtual void repeat_frame() {}
+};
+
+// Drops every frame without rendering it.
+class NullFrameSink : public FrameSink {
+    public:
+        FrameSpan begin_frame() override { return {}; }
+        void end_frame(const FrameSpan&) override {}
+};
+
+// Keeps the last completed frame in memory. Two buffers are swapped so
+// frame() stays valid while the next one is drawn.
+class MemoryFrameSink : public FrameSink {
+    public:
+        MemoryFrameSink();
+        ~MemoryFrameSink();
+
+        MemoryFrameSink(const MemoryFrameSink&) = delete;
+        MemoryFrameSink& operator=(const MemoryFrameSink&) = delete;
+
+        FrameSpan begin_frame() override;
+        void end_frame(const FrameSpan&) override;
+        void repeat_frame() override { ++m_frame_count; }
+
+        inline FrameSpan frame() const { return { m_buffers[m_front], SCREEN_WIDTH }; }
+        inline u64 frame_count() const { return m_frame_count; }
+
+    private:
+        u32* m_buffers[2] { nullptr, nullptr };
+        usize m_front { 0 };
+        u64 m_frame_count { 0 };
+};
+
+// Appends each frame to a file as raw 160x144 32-bit pixels, e.g. for
+// `ffmpeg -f rawvideo -pixel_format rgb0 -video_size 160x144`.
+class FileFrameSink : public FrameSink {
+    public:
+        explicit FileFrameSink(const char* path);
+        ~FileFrameSink();
+
+        FileFrameSink(const FileFrameSink&) = delete;
+        FileFrameSink& operator=(const FileFrameSink&) = delete;
+
+        FrameSpan begin_frame() override;
+        void end_frame(const FrameSpan&) override;
+        void repeat_frame() override;
+
+    private:
+        FILE* m_file { nullptr };
+        u32* m_buffer { nullptr };
+};
+
+// Hands completed frames from the emulation thread to a presenting thread
+// without locks. The producer draws into its own buffer and swaps it with
+// the shared middle one at VBlank; the consumer swaps its buffer with the
+// middle one when a newer frame is there. Neither side ever waits.
+class TripleBufferSink : public FrameSink {
+    public:
+        TripleBufferSink();
+        ~TripleBufferSink();
+
+        TripleBufferSink(const TripleBufferSink&) = delete;
+        TripleBufferSink& operator=(const TripleBufferSink&) = delete;
+
+        // producer side
+        FrameSpan begin_frame() override;
+        void end_frame(const FrameSpan&) override;
+
+        // consumer side: the newest completed frame, true if it was not
+        // acquired before
+        bool acquire(FrameSpan& frame);
+
+        // frames overwritten before being acquired
+        inline u64 dropped_frames() const
+        {
+            return m_dropped_frames.load(std::memory_order_relaxed);
+        }
+        // acquires that found no new frame
+        inline u64 repeated_frames() const
+        {
+            return m_repeated_frames.load(std::memory_order_relaxed);
+        }
+
+    private:
+        static const u8 FRESH = 0x80;
+
+        u32* m_buffers[3] { nullptr, nullptr, nullptr };
+        usize m_back { 0 };
+        usize m_front { 1 };
+        bool m_acquired_any { false };
+        // index of the middle buffer, with FRESH set while not yet acquired
+        std::atomic<u8> m_middle { 2 };
+        std::atomic<u64> m_dropped_frames { 0 };
+        std::atomic<u64> m_repeated_frames { 0 };
+};
+
+} // namespace GB
@@ -0,0 +1,205 @@
+#include "Gbs.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "Log.hpp"
+
+namespace GB {
+
+static const u64 VBLANK_PERIOD = 70224;
+// the driver and the vectors live below this, the code above
+static const u16 MIN_LOAD_ADDRESS = 0x400;
+static const u16 DRIVER_ADDRESS = 0x150;
+static const usize MAX_ROM_SIZE = 8 * 1024 * KB;
+
+static u16 get_u16(const u8* data)
+{
+    return data[0] | (data[1] << 8);
+}
+
+static std::string get_string(const u8* data, usize size)
+{
+    return std::string((const char*)data, strnlen((const char*)data, size));
+}
+
+std::unique_ptr<GbsFile> GbsFile::load(const char* filename)
+{
+    auto file = fopen(filename, "rb");
+    if (!file) {
+        perror(filename);
+        exit(-1);
+    }
+
+    fseek(file, 0, SEEK_END);
+    auto size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    auto* data = (u8*)malloc(size);
+    if (!fread(data, size, 1, file)) {
+        perror(filename);
+        fclose(file);
+        exit(-1);
+    }
+    fclose(file);
+
+    auto gbs = std::make_unique<GbsFile>(data, (usize)size);
+    free(data);
+    return gbs;
+}
+
+GbsFile::GbsFile(const u8* data, usize size)
+{
+    if (size <= HEADER_SIZE || memcmp(data, "GBS", 3) != 0 || data[3] != 1) {
+        fprintf(stderr, "not a version 1 GBS file\n");
+        exit(-1);
+    }
+
+    m_song_count = data[0x04];
+    m_first_song = data[0x05];
+    m_load_address = get_u16(data + 0x06);
+    m_init_address = get_u16(data + 0x08);
+    m_play_address = get_u16(data + 0x0a);
+    m_stack_pointer = get_u16(data + 0x0c);
+    m_timer_modulo = data[0x0e];
+    m_timer_control = data[0x0f];
+    m_title = get_string(data + 0x10, 32);
+    m_author = get_string(data + 0x30, 32);
+    m_copyright = get_string(data + 0x50, 32);
+
+    if (m_song_count == 0 || m_first_song == 0 || m_first_song > m_song_count) {
+        fprintf(stderr, "GBS file has no song %d of %d\n", m_first_song, m_song_count);
+        exit(-1);
+    }
+    if (m_load_address < MIN_LOAD_ADDRESS || m_load_address >= 0x8000) {
+        fprintf(stderr, "GBS load address %#06x is outside the ROM\n", m_load_address);
+        exit(-1);
+    }
+    if (m_timer_control & 0x80)
+        LOG_WARNING("GBS asks for CGB double speed, playing at normal speed");
+
+    m_rom = build_rom(data + HEADER_SIZE, size - HEADER_SIZE);
+}
+
+// The image holds the code at its load address, banked as usual above
+// 0x4000. Below the load address:
+// - RST n jumps to load + n, as GBS code expects
+// - the interrupt vectors only return, waking the driver from HALT
+// - the entry point jumps to the driver, which enables the cartridge RAM,
+//   programs the timer and interrupts, calls init with the song in A, as
+//   left there by GbsPlayer, then calls play after each interrupt
+std::shared_ptr<const RomImage> GbsFile::build_rom(const u8* code, usize size) const
+{
+    usize banks = 2;
+    while (banks * ROM_BANK_SIZE < m_load_address + size)
+        banks *= 2;
+    usize rom_size = banks * ROM_BANK_SIZE;
+    if (rom_size > MAX_ROM_SIZE) {
+        fprintf(stderr, "GBS code is too large (%ld bytes)\n", size);
+        exit(-1);
+    }
+
+    auto* rom = (u8*)malloc(rom_size);
+    assert(rom);
+    memset(rom, 0xff, rom_size);
+    memcpy(rom + m_load_address, code, size);
+
+    for (u16 rst = 0x00; rst <= 0x38; rst += 0x08) {
+        u16 target = m_load_address + rst;
+        rom[rst] = 0xc3; // JP
+        rom[rst + 1] = target & 0xff;
+        rom[rst + 2] = target >> 8;
+    }
+    for (u16 vector = 0x40; vector <= 0x60; vector += 0x08)
+        rom[vector] = 0xd9; // RETI
+
+    u8 entry[] = {
+        0x00,                       // NOP
+        0xc3, DRIVER_ADDRESS & 0xff, DRIVER_ADDRESS >> 8, // JP driver
+    };
+    memcpy(rom + 0x100, entry, sizeof(entry));
+
+    u8 interrupts = timer_driven() ? 0x04 : 0x01;
+    u8 driver[] = {
+        0xf3,                       // DI
+        0x31, (u8)(m_stack_pointer & 0xff), (u8)(m_stack_pointer >> 8), // LD SP, sp
+        0x21, 0x00, 0x00,           // LD HL, 0x0000
+        0x36, 0x0a,                 // LD (HL), 0x0a
+        0x21, 0x06, 0xff,           // LD HL, TMA
+        0x36, m_timer_modulo,       // LD (HL), modulo
+        0x2c,                       // INC L
+        0x36, (u8)(m_timer_control & 0x07), // LD (HL), control
+        0x21, 0x0f, 0xff,           // LD HL, IF
+        0x36, 0x00,                 // LD (HL), 0
+        0x21, 0xff, 0xff,           // LD HL, IE
+        0x36, interrupts,           // LD (HL), interrupts
+        0xcd, (u8)(m_init_address & 0xff), (u8)(m_init_address >> 8), // CALL init
+        0xfb,                       // EI
+        0x76,                       // loop: HALT
+        0xcd, (u8)(m_play_address & 0xff), (u8)(m_play_address >> 8), // CALL play
+        0x18, 0xfa,                 // JR loop
+    };
+    assert(DRIVER_ADDRESS + sizeof(driver) <= MIN_LOAD_ADDRESS);
+    memcpy(rom + DRIVER_ADDRESS, driver, sizeof(driver));
+
+    // an MBC5 with 8 KB of RAM, the header as CartHeader reads it
+    memset(rom + 0x104, 0x00, 0x4c);
+    memcpy(rom + 0x134, m_title.data(), m_title.size() < 15 ? m_title.size() : 15);
+    rom[0x147] = 0x1a;
+    u8 size_code = 0;
+    while ((2u << size_code) < banks)
+        ++size_code;
+    rom[0x148] = size_code;
+    rom[0x149] = 0x02;
+    u8 checksum = 0;
+    for (usize index = 0x134; index <= 0x14c; ++index)
+        checksum -= rom[index] + 1;
+    rom[0x14d] = checksum;
+
+    auto image = std::make_shared<const RomImage>(rom, rom_size);
+    free(rom);
+    return image;
+}
+
+GbsPlayer::GbsPlayer(const GbsFile& gbs, AudioSink* audio_sink)
+    : m_gbs(gbs)
+    , m_audio_sink(audio_sink)
+{
+}
+
+void GbsPlayer::start(u8 song)
+{
+    if (song == 0 || song > m_gbs.song_count()) {
+        fprintf(stderr, "GBS file has no song %d of %d\n", song, m_gbs.song_count());
+        exit(-1);
+    }
+
+    m_emulator.reset();
+    m_cart = std::make_unique<Cart>(m_gbs.rom());
+    m_emulator = std::make_unique<Emulator>(m_cart.get(), nullptr, m_audio_sink);
+    m_emulator->set_ppu_enabled(false);
+    m_emulator->cpu().setA(song - 1);
+    m_next_vblank = m_emulator->cpu().cycles() + VBLANK_PERIOD;
+}
+
+void GbsPlayer::run_for(u64 cycles)
+{
+    auto& cpu = m_emulator->cpu();
+    u64 end = cpu.cycles() + cycles;
+    while (cpu.cycles() < end) {
+        u64 until = end;
+        if (!m_gbs.timer_driven() && m_next_vblank < until)
+            until = m_next_vblank;
+        if (cpu.cycles() < until)
+            m_emulator->exec_for(until - cpu.cycles());
+
+        if (!m_gbs.timer_driven() && cpu.cycles() >= m_next_vblank) {
+            cpu.request_vblank_interrupt();
+            m_next_vblank += VBLANK_PERIOD;
+        }
+    }
+}
+
+}
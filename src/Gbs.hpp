@@ -0,0 +1,78 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "AudioSink.hpp"
+#include "Cart.hpp"
+#include "Emulator.hpp"
+
+namespace GB {
+
+// A GBS rip: the music code of a game, loaded at a fixed address, with an
+// init routine to start a song and a play routine to call at the timer or
+// VBlank rate. It is run as a cartridge of its own: the code sits in an
+// MBC5 ROM image at its load address, below which a small driver calls the
+// routines.
+class GbsFile {
+    public:
+        static std::unique_ptr<GbsFile> load(const char* filename);
+
+        GbsFile(const u8* data, usize size);
+
+        GbsFile(const GbsFile&) = delete;
+        GbsFile& operator=(const GbsFile&) = delete;
+
+        inline u8 song_count() const { return m_song_count; }
+        // 1-based
+        inline u8 first_song() const { return m_first_song; }
+        inline const std::string& title() const { return m_title; }
+        inline const std::string& author() const { return m_author; }
+        inline const std::string& copyright() const { return m_copyright; }
+        // play is called from the timer interrupt, not VBlank
+        inline bool timer_driven() const { return m_timer_control & 0x04; }
+
+        const std::shared_ptr<const RomImage>& rom() const { return m_rom; }
+
+    private:
+        static const usize HEADER_SIZE = 0x70;
+
+        u8 m_song_count;
+        u8 m_first_song;
+        u16 m_load_address;
+        u16 m_init_address;
+        u16 m_play_address;
+        u16 m_stack_pointer;
+        u8 m_timer_modulo;
+        u8 m_timer_control;
+        std::string m_title;
+        std::string m_author;
+        std::string m_copyright;
+        std::shared_ptr<const RomImage> m_rom;
+
+        std::shared_ptr<const RomImage> build_rom(const u8* code, usize size) const;
+};
+
+// Runs only the CPU and the APU: the PPU is never clocked, VBlank is
+// requested every 70224 cycles instead. Nothing paces it, samples go to
+// the sink as fast as the CPU gets through the play routine.
+class GbsPlayer {
+    public:
+        GbsPlayer(const GbsFile&, AudioSink*);
+
+        // restarts the emulation with `song`, 1-based
+        void start(u8 song);
+        // runs at least `cycles` T-cycles of the song
+        void run_for(u64 cycles);
+
+        inline Emulator& emulator() { return *m_emulator; }
+
+    private:
+        const GbsFile& m_gbs;
+        AudioSink* m_audio_sink;
+        std::unique_ptr<Cart> m_cart;
+        std::unique_ptr<Emulator> m_emulator;
+        u64 m_next_vblank { 0 };
+};
+
+}
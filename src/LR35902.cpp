@@ -2,6 +2,7 @@
 
 #include "LR35902.hpp"
 #include "Emulator.hpp"
+#include "Log.hpp"
 
 //#define TRACE
 
@@ -29,6 +30,20 @@ void LR35902::cycle()
         return;
     }
 
+    if (m_resuming_from_break && PC() == m_break_PC) {
+        m_resuming_from_break = false;
+    } else if (m_emulator.mmu().page_flags(PC()) & AccessKind::EXECUTE) {
+        m_emulator.mmu().check_watchpoint(
+                AccessKind::EXECUTE,
+                PC(),
+                m_emulator.mmu().peek8(PC()));
+        if (m_emulator.break_requested()) {
+            m_resuming_from_break = true;
+            m_break_PC = PC();
+            return;
+        }
+    }
+
     auto saved_PC = PC();
     auto ins = Instruction::from_stream(this);
 
@@ -223,11 +238,15 @@ bool LR35902::check_condition(InstructionCondition condition)
 
 void LR35902::do_cycle()
 {
+    m_cycles += 4;
+
     if (doing_dma())
         cycle_dma();
 
+    bool ppu_enabled = m_emulator.ppu_enabled();
     for (usize i = 0; i < 4; ++i) {
-        m_emulator.ppu().cycle();
+        if (ppu_enabled)
+            m_emulator.ppu().cycle();
         m_emulator.joypad().cycle();
         m_emulator.timer().cycle();
         m_emulator.apu().cycle();
@@ -244,7 +263,10 @@ bool LR35902::handle_interrupt()
     if (triggerable_interrupts == 0)
         return false;
 
-    m_stopped = false;
+    if (m_stopped) {
+        m_emulator.ppu().notify_picture_change();
+        m_stopped = false;
+    }
     m_halted = false;
 
     if (!m_interrupts_enabled)
@@ -320,6 +342,7 @@ void LR35902::NOP(const Instruction&)
 void LR35902::STOP(const Instruction&)
 {
     setPC(PC() + 1); // next byte is always skipped
+    m_emulator.ppu().notify_picture_change();
     m_stopped = true;
 }
 
@@ -1038,7 +1061,7 @@ void LR35902::RET(const Instruction&)
 {
     if (m_emulator.trace()) {
         if (m_debug_call_stack.empty())
-            fprintf(stderr, "WARNING: RET with empty call stack\n");
+            LOG_WARNING("RET with empty call stack");
         else
             m_debug_call_stack.pop_back();
     }
@@ -1054,7 +1077,7 @@ void LR35902::RET_cond(const Instruction& ins)
     if (check_condition(ins.condition())) {
         if (m_emulator.trace()) {
             if (m_debug_call_stack.empty())
-                fprintf(stderr, "WARNING: RET with empty call stack\n");
+                LOG_WARNING("RET with empty call stack");
             else
                 m_debug_call_stack.pop_back();
         }
@@ -1070,7 +1093,7 @@ void LR35902::RETI(const Instruction&)
     m_interrupts_enabled = true;
     if (m_emulator.trace()) {
         if (m_debug_call_stack.empty())
-            fprintf(stderr, "WARNING: RET with empty call stack\n");
+            LOG_WARNING("RET with empty call stack");
         else
             m_debug_call_stack.pop_back();
     }
@@ -17,6 +17,7 @@ class LR35902 final
         ~LR35902() {}
 
         void cycle();
+        u64 cycles() const { return m_cycles; }
         bool stopped() const { return m_stopped; }
         bool halted() const { return m_halted; }
         void dump_registers() const;
@@ -264,6 +265,12 @@ class LR35902 final
         bool m_halted { false };
         bool m_interrupts_enabled { true };
 
+        u64 m_cycles { 0 };
+        // set when an execute breakpoint stopped us before the instruction at
+        // m_break_PC, which is let through once, even after an interrupt
+        bool m_resuming_from_break { false };
+        u16 m_break_PC { 0 };
+
         u8 m_interrupt_enable_reg { 0 };
         u8 m_interrupt_flag_reg { 0 };
 
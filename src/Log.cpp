@@ -0,0 +1,166 @@
+#include "Log.hpp"
+
+#include <cstring>
+
+namespace GB {
+namespace Log {
+
+static const usize RING_TEXT_SIZE = 256;
+
+struct RingEntry {
+    // 2 * index + 1 while being written, 2 * index + 2 once complete
+    std::atomic<u64> sequence { 0 };
+    char text[RING_TEXT_SIZE];
+};
+
+static std::atomic<Site*> s_sites { nullptr };
+static std::atomic<RingEntry*> s_ring { nullptr };
+static usize s_ring_mask { 0 };
+static std::atomic<u64> s_ring_head { 0 };
+static std::atomic<u64> s_ring_busy { 0 };
+
+static void register_site(Site& site)
+{
+    if (site.registered.exchange(true, std::memory_order_relaxed))
+        return;
+
+    Site* head = s_sites.load(std::memory_order_relaxed);
+    do {
+        site.next = head;
+    } while (!s_sites.compare_exchange_weak(
+                head,
+                &site,
+                std::memory_order_release,
+                std::memory_order_relaxed));
+}
+
+static usize format_line(
+        char* buffer,
+        usize size,
+        Site& site,
+        u64 count,
+        const char* message,
+        usize length)
+{
+    fmt::format_to_n_result<char*> result;
+    if (count > BURST_COUNT) {
+        result = fmt::format_to_n(
+                buffer, size - 1,
+                "{}: {} [x{}]\n",
+                site.level,
+                fmt::string_view(message, length),
+                count);
+    } else {
+        result = fmt::format_to_n(
+                buffer, size - 1,
+                "{}: {}\n",
+                site.level,
+                fmt::string_view(message, length));
+    }
+
+    usize written = result.size < size - 1 ? result.size : size - 1;
+    buffer[written] = '\0';
+    return written;
+}
+
+void write(Site& site, u64 count, const char* message, usize length)
+{
+    register_site(site);
+
+    auto* ring = s_ring.load(std::memory_order_acquire);
+    if (!ring) {
+        char line[RING_TEXT_SIZE];
+        auto line_length = format_line(
+                line, sizeof(line), site, count, message, length);
+        fwrite(line, 1, line_length, stderr);
+        return;
+    }
+
+    // the slot is only taken over from a complete older entry: when a
+    // stalled writer is still in it, or a newer one already took it, the
+    // message is dropped
+    u64 index = s_ring_head.fetch_add(1, std::memory_order_relaxed);
+    auto& entry = ring[index & s_ring_mask];
+    u64 sequence = entry.sequence.load(std::memory_order_relaxed);
+    do {
+        if ((sequence & 1) || sequence > 2 * index) {
+            s_ring_busy.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    } while (!entry.sequence.compare_exchange_weak(
+                sequence,
+                2 * index + 1,
+                std::memory_order_acquire,
+                std::memory_order_relaxed));
+    std::atomic_thread_fence(std::memory_order_release);
+    format_line(entry.text, RING_TEXT_SIZE, site, count, message, length);
+    entry.sequence.store(2 * index + 2, std::memory_order_release);
+}
+
+void enable_ring(usize capacity)
+{
+    if (ring_enabled())
+        return;
+
+    usize size = 1;
+    while (size < capacity)
+        size <<= 1;
+
+    s_ring_mask = size - 1;
+    s_ring.store(new RingEntry[size], std::memory_order_release);
+}
+
+bool ring_enabled()
+{
+    return s_ring.load(std::memory_order_acquire) != nullptr;
+}
+
+void dump_ring(FILE* output)
+{
+    auto* ring = s_ring.load(std::memory_order_acquire);
+    if (!ring)
+        return;
+
+    u64 head = s_ring_head.load(std::memory_order_acquire);
+    u64 capacity = s_ring_mask + 1;
+    u64 first = head > capacity ? head - capacity : 0;
+
+    char text[RING_TEXT_SIZE];
+    for (u64 index = first; index < head; ++index) {
+        auto& entry = ring[index & s_ring_mask];
+        if (entry.sequence.load(std::memory_order_acquire) != 2 * index + 2)
+            continue;
+        std::memcpy(text, entry.text, RING_TEXT_SIZE);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // overwritten while we were copying it
+        if (entry.sequence.load(std::memory_order_relaxed) != 2 * index + 2)
+            continue;
+        text[RING_TEXT_SIZE - 1] = '\0';
+        fputs(text, output);
+    }
+
+    if (first > 0)
+        fprintf(output, "(%lu older log entries dropped)\n", first);
+    u64 busy = s_ring_busy.load(std::memory_order_relaxed);
+    if (busy > 0)
+        fprintf(output, "(%lu log entries dropped, their slot was still being written)\n", busy);
+}
+
+void dump_counters(FILE* output)
+{
+    for (auto* site = s_sites.load(std::memory_order_acquire);
+            site;
+            site = site->next) {
+        fprintf(
+                output,
+                "%8lu %-8s %s:%d\n",
+                site->count.load(std::memory_order_relaxed),
+                site->level,
+                site->file,
+                site->line
+               );
+    }
+}
+
+} // namespace Log
+} // namespace GB
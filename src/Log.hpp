@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+
+#include <fmt/format.h>
+
+#include "Defs.hpp"
+
+// Compile-time log levels. Anything below LOG_LEVEL is compiled out entirely,
+// arguments included. `make release` builds with LOG_LEVEL_ERROR.
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARNING 3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_NONE 5
+
+#ifndef LOG_LEVEL
+#ifdef DEBUG
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#else
+#define LOG_LEVEL LOG_LEVEL_WARNING
+#endif
+#endif
+
+namespace GB {
+namespace Log {
+
+// Every call site gets its own Site: it counts the hits and is used to rate
+// limit the output. The first BURST_COUNT hits are printed, after that only
+// hits whose count is a power of two are.
+static const u64 BURST_COUNT = 8;
+static const usize MESSAGE_SIZE = 240;
+
+struct Site {
+    constexpr Site(const char* level, const char* file, int line)
+        : level(level)
+        , file(file)
+        , line(line)
+    {
+    }
+
+    const char* level;
+    const char* file;
+    int line;
+    std::atomic<u64> count { 0 };
+    std::atomic<bool> registered { false };
+    Site* next { nullptr };
+};
+
+void write(Site&, u64 count, const char* message, usize length);
+
+// Sends the messages to an in-memory ring of `capacity` entries (rounded up
+// to a power of two) instead of stderr. Writers never block nor allocate: a
+// writer that laps one still formatting into the same entry drops its
+// message, which dump_ring counts.
+void enable_ring(usize capacity);
+bool ring_enabled();
+void dump_ring(FILE*);
+
+// Hit counts of every site that logged at least once.
+void dump_counters(FILE*);
+
+template <typename... Args>
+[[gnu::cold, gnu::noinline]] void emit(
+        Site& site,
+        u64 count,
+        const char* format,
+        const Args&... args)
+{
+    char message[MESSAGE_SIZE];
+    auto result = fmt::format_to_n(message, MESSAGE_SIZE, format, args...);
+    usize length = result.size < MESSAGE_SIZE ? result.size : MESSAGE_SIZE;
+    write(site, count, message, length);
+}
+
+template <typename... Args>
+inline void discard(const char*, const Args&...)
+{
+}
+
+template <typename... Args>
+inline void hit(Site& site, const char* format, const Args&... args)
+{
+    u64 count = site.count.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (count <= BURST_COUNT || (count & (count - 1)) == 0)
+        emit(site, count, format, args...);
+}
+
+} // namespace Log
+} // namespace GB
+
+#define LOG_AT(level, ...)                                              \
+    do {                                                                \
+        static ::GB::Log::Site log_site_ { level, __FILE__, __LINE__ }; \
+        ::GB::Log::hit(log_site_, __VA_ARGS__);                         \
+    } while (0)
+
+// keeps the arguments "used" without evaluating them
+#define LOG_DISABLED(...)                                               \
+    do {                                                                \
+        if (false)                                                      \
+            ::GB::Log::discard(__VA_ARGS__);                            \
+    } while (0)
+
+#if LOG_LEVEL <= LOG_LEVEL_TRACE
+#define LOG_TRACE(...) LOG_AT("TRACE", __VA_ARGS__)
+#else
+#define LOG_TRACE(...) LOG_DISABLED(__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_AT("DEBUG", __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) LOG_DISABLED(__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_AT("INFO", __VA_ARGS__)
+#else
+#define LOG_INFO(...) LOG_DISABLED(__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARNING
+#define LOG_WARNING(...) LOG_AT("WARNING", __VA_ARGS__)
+#else
+#define LOG_WARNING(...) LOG_DISABLED(__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) LOG_AT("ERROR", __VA_ARGS__)
+#else
+#define LOG_ERROR(...) LOG_DISABLED(__VA_ARGS__)
+#endif
@@ -2,6 +2,7 @@
 
 #include "MemoryMapper.hpp"
 #include "Emulator.hpp"
+#include "Log.hpp"
 
 namespace GB {
 
@@ -9,14 +10,10 @@ MemoryMapper::MemoryMapper(Emulator& emulator, Cart* cart)
     : m_emulator(emulator)
     , m_cart(cart)
 {
-    m_work_ram = (u8*)malloc(WORK_RAM_SIZE);
-    m_high_ram = (u8*)malloc(HIGH_RAM_SIZE);
 }
 
 MemoryMapper::~MemoryMapper()
 {
-    free(m_high_ram);
-    free(m_work_ram);
 }
 
 u8 MemoryMapper::read8(u16 address)
@@ -26,7 +23,10 @@ u8 MemoryMapper::read8(u16 address)
         return 0xff;
     }
 
-    return read8_bypass(address);
+    u8 value = read8_bypass(address);
+    if (page_flags(address) & AccessKind::READ)
+        check_watchpoint(AccessKind::READ, address, value);
+    return value;
 }
 
 void MemoryMapper::write8(u16 address, u8 value)
@@ -34,9 +34,61 @@ void MemoryMapper::write8(u16 address, u8 value)
     if (m_emulator.cpu().doing_dma() && (address < 0xff80 || address > 0xfffe))
         return;
 
+    if (page_flags(address) & AccessKind::WRITE)
+        check_watchpoint(AccessKind::WRITE, address, value);
     write8_bypass(address, value);
 }
 
+void MemoryMapper::add_watchpoint(u16 address, u8 kinds)
+{
+    for (auto& watchpoint : m_watchpoints) {
+        if (watchpoint.address == address) {
+            watchpoint.kinds |= kinds;
+            update_page_flags(address);
+            return;
+        }
+    }
+
+    m_watchpoints.push_back({ address, kinds });
+    update_page_flags(address);
+}
+
+void MemoryMapper::remove_watchpoint(u16 address, u8 kinds)
+{
+    for (usize index = 0; index < m_watchpoints.size(); ++index) {
+        auto& watchpoint = m_watchpoints[index];
+        if (watchpoint.address != address)
+            continue;
+
+        watchpoint.kinds &= ~kinds;
+        if (watchpoint.kinds == 0)
+            m_watchpoints.erase(m_watchpoints.begin() + index);
+        break;
+    }
+    update_page_flags(address);
+}
+
+void MemoryMapper::update_page_flags(u16 address)
+{
+    usize page = address >> WATCH_PAGE_SHIFT;
+    u8 flags = 0;
+    for (auto& watchpoint : m_watchpoints) {
+        if ((usize)(watchpoint.address >> WATCH_PAGE_SHIFT) == page)
+            flags |= watchpoint.kinds;
+    }
+    m_page_flags[page] = flags;
+}
+
+void MemoryMapper::check_watchpoint(AccessKind::Kind kind, u16 address, u8 value)
+{
+    for (auto& watchpoint : m_watchpoints) {
+        if (watchpoint.address == address && (watchpoint.kinds & kind)) {
+            m_emulator.notify_breakpoint(kind, address, value);
+            return;
+        }
+    }
+}
+
 void MemoryMapper::dma_copy(u8 sector, u8 offset)
 {
     u16 src_address = ((u16)sector << 8) | (u16)offset;
@@ -113,7 +165,7 @@ void MemoryMapper::write8_bypass(u16 address, u8 value)
     }
 
     if (address < 0xff00) { // Unusable space
-        fprintf(stderr, "WARNING: write to unusable space\n");
+        LOG_WARNING("write to unusable space {:#06x}", address);
         return;
     }
 
@@ -208,7 +260,7 @@ u8 MemoryMapper::read_io8(u8 reg)
         case 0x2d:
         case 0x2e:
         case 0x2f:
-            fprintf(stderr, "WARNING: reading from unused io register 0x%02x\n", reg);
+            LOG_WARNING("reading from unused io register {:#04x}", reg);
             return 0xff;
 
         case 0x30: // Wave Pattern RAM
@@ -257,7 +309,7 @@ u8 MemoryMapper::read_io8(u8 reg)
         case 0x4d:
         case 0x55:
         case 0x70:
-            //fprintf(stderr, "WARNING: reading from CGB-only register\n");
+            LOG_DEBUG("reading from CGB-only register {:#04x}", reg);
             return 0xff;
 
         case 0xff: // IE - Interrupt Enable
@@ -317,7 +369,7 @@ void MemoryMapper::write_io8(u8 reg, u8 value)
             m_emulator.apu().set_NR14(value);
             break;
         case 0x15:
-            fprintf(stderr, "WARNING: writing to unused io register 0x%02x\n", reg);
+            LOG_WARNING("writing to unused io register {:#04x}", reg);
             break;
         case 0x16:
             m_emulator.apu().set_NR21(value);
@@ -347,7 +399,7 @@ void MemoryMapper::write_io8(u8 reg, u8 value)
             m_emulator.apu().set_NR34(value);
             break;
         case 0x1f:
-            fprintf(stderr, "WARNING: writing to unused io register 0x%02x\n", reg);
+            LOG_WARNING("writing to unused io register {:#04x}", reg);
             break;
         case 0x20:
             m_emulator.apu().set_NR41(value);
@@ -380,7 +432,7 @@ void MemoryMapper::write_io8(u8 reg, u8 value)
         case 0x2d:
         case 0x2e:
         case 0x2f:
-            fprintf(stderr, "WARNING: writing to unused io register 0x%02x\n", reg);
+            LOG_WARNING("writing to unused io register {:#04x}", reg);
             break;
 
         case 0x30: // Wave Pattern RAM
@@ -415,7 +467,7 @@ void MemoryMapper::write_io8(u8 reg, u8 value)
             m_emulator.ppu().set_scroll_x(value);
             break;
         case 0x44: // LY - LCDC Y-Coordinate
-            fprintf(stderr, "WARNING: Writing to read-only io register FF44\n");
+            LOG_WARNING("writing to read-only io register FF44");
             break;
         case 0x45: // LYC - LY Compare
             m_emulator.ppu().set_ly_compare(value);
@@ -451,17 +503,13 @@ void MemoryMapper::write_io8(u8 reg, u8 value)
         case 0x68:
         case 0x69:
         case 0x70:
-            //fprintf(stderr, "WARNING: writing to CGB-only register\n");
+            LOG_DEBUG("writing to CGB-only register {:#04x}", reg);
             break;
 
         case 0x4e:
         case 0x50:
         case 0x7f:
-            fprintf(
-                    stderr,
-                    "WARNING: writing to undefined register %#04x\n",
-                    reg
-                   );
+            LOG_WARNING("writing to undefined register {:#04x}", reg);
             break;
 
         case 0xff: // IE - Interrupt Enable
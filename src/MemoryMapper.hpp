@@ -1,5 +1,7 @@
 #pragma once
 
+#include <vector>
+
 #include "Cart.hpp"
 
 namespace GB {
@@ -7,6 +9,17 @@ namespace GB {
 static const usize WORK_RAM_SIZE = 0x2000;
 static const usize HIGH_RAM_SIZE = 0x007f;
 
+static const usize WATCH_PAGE_SHIFT = 8;
+static const usize WATCH_PAGE_COUNT = 0x10000 >> WATCH_PAGE_SHIFT;
+
+struct AccessKind {
+    enum Kind {
+        READ = 0x01,
+        WRITE = 0x02,
+        EXECUTE = 0x04,
+    };
+};
+
 class Emulator;
 
 class MemoryMapper {
@@ -17,19 +30,39 @@ class MemoryMapper {
         u8 read8(u16);
         void write8(u16, u8);
         void dma_copy(u8, u8);
+        inline u8 peek8(u16 address) { return read8_bypass(address); }
+
+        // Watchpoints only cost a flag test on their page: accesses to pages
+        // without any go through the fast path.
+        inline u8 page_flags(u16 address) const
+        {
+            return m_page_flags[address >> WATCH_PAGE_SHIFT];
+        }
+        void add_watchpoint(u16 address, u8 kinds);
+        void remove_watchpoint(u16 address, u8 kinds);
+        void check_watchpoint(AccessKind::Kind, u16 address, u8 value);
 
     private:
+        struct Watchpoint {
+            u16 address;
+            u8 kinds;
+        };
+
         u8 read8_bypass(u16);
         void write8_bypass(u16, u8);
+        void update_page_flags(u16 address);
 
         u8 read_io8(u8 reg);
         void write_io8(u8 reg, u8 value);
 
         Emulator& m_emulator;
         Cart* m_cart;
-        u8* m_work_ram;
-        u8* m_high_ram;
-        u8 m_serial_data;
+        u8 m_work_ram[WORK_RAM_SIZE] {};
+        u8 m_high_ram[HIGH_RAM_SIZE] {};
+        u8 m_serial_data { 0 };
+
+        u8 m_page_flags[WATCH_PAGE_COUNT] {};
+        std::vector<Watchpoint> m_watchpoints {};
 };
 
 }
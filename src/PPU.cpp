@@ -4,6 +4,7 @@
 #include <cassert>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 
 namespace GB {
 
@@ -14,26 +15,98 @@ const static u8 COLORS[4][3] = {
     { 0x2d, 0x1b, 0x00 },
 };
 
-const static usize PIXEL_BUFFER_SIZE = 160 * 144 * 3;
+// A pixel of the XBGR8888 frames
+static inline u32 texture_color(u8 color)
+{
+    return COLORS[color][0]
+        | (COLORS[color][1] << 8)
+        | (COLORS[color][2] << 16);
+}
+
+static NullFrameSink null_sink;
 
-PPU::PPU(Emulator& emulator, SDL_Texture* screen)
+PPU::PPU(Emulator& emulator, FrameSink* sink)
     : m_emulator(emulator)
-    , m_screen(screen)
+    , m_sink(sink ? sink : &null_sink)
+{
+    build_palette_lut(m_bg_palette, m_bg_colors);
+    build_palette_lut(m_object_palette0, m_obj_colors[0]);
+    build_palette_lut(m_object_palette1, m_obj_colors[1]);
+}
+
+void PPU::build_palette_lut(u8 palette, u32* lut)
+{
+    for (u8 color_index = 0; color_index < 4; ++color_index)
+        lut[color_index] = texture_color((palette >> (color_index * 2)) & 0x03);
+}
+
+void PPU::start_frame()
+{
+    m_accurate = m_policy == RenderPolicy::ACCURATE
+        || (m_policy == RenderPolicy::AUTO && m_mid_line_write);
+    m_mid_line_write = false;
+
+    // the accurate renderer has no replay, it draws every frame
+    m_skipping = !m_dirty && !m_accurate;
+    m_dirty = false;
+}
+
+// A skipped frame is about to change: nothing changed since it started, so
+// the lines the LCD already went past are drawn now with the current state.
+void PPU::resume_rendering()
+{
+    m_skipping = false;
+
+    usize line = m_pixel_y;
+    usize window_line = m_window_line;
+    bool was_window = m_was_window;
+    usize sprite_count = m_scanline_sprite_count;
+    Sprite* sprites[10];
+    std::memcpy(sprites, m_scanline_sprites, sizeof(sprites));
+
+    usize replayed_lines = m_mode == ModeFlag::HBLANK ? line + 1 : line;
+    m_window_line = 0;
+    for (m_pixel_y = 0; m_pixel_y < replayed_lines; ++m_pixel_y) {
+        gather_sprites();
+        m_was_window = false;
+        render_scanline(0, 160);
+        if (m_was_window)
+            ++m_window_line;
+    }
+    assert(m_window_line == window_line);
+
+    m_pixel_y = line;
+    m_rendered_x = 0;
+    m_was_window = was_window;
+    m_scanline_sprite_count = sprite_count;
+    std::memcpy(m_scanline_sprites, sprites, sizeof(sprites));
+
+    if (m_mode == ModeFlag::TRANSFER && m_pixel_x > 0)
+        render_scanline(0, m_pixel_x);
+}
+
+// What render_scanline would find for the whole line
+bool PPU::window_on_line() const
 {
-    m_vram = (u8*)malloc(VRAM_SIZE);
-    m_oam = (u8*)malloc(OAM_SIZE);
-    m_pixels = (u8*)malloc(PIXEL_BUFFER_SIZE);
+    if (m_emulator.cpu().stopped() || !display_enabled()
+            || !bg_display_enabled() || !window_display_enabled())
+        return false;
+    return (i32)m_pixel_y >= (i32)m_window_y && (i32)m_window_x - 7 < 160;
+}
 
-    //assert(m_screen);
-    assert(m_vram);
-    assert(m_pixels);
+void PPU::begin_frame()
+{
+    m_frame = m_sink->begin_frame();
+    m_in_frame = true;
 }
 
-PPU::~PPU()
+void PPU::end_frame()
 {
-    free(m_pixels);
-    free(m_oam);
-    free(m_vram);
+    if (!m_in_frame)
+        return;
+    m_sink->end_frame(m_frame);
+    m_frame = {};
+    m_in_frame = false;
 }
 
 u8 PPU::read8(u32 offset)
@@ -47,7 +120,22 @@ void PPU::write8(u32 offset, u8 value)
 {
     assert(offset < VRAM_SIZE);
 
+    if (m_vram[offset] == value)
+        return;
+    catch_up();
     m_vram[offset] = value;
+    if (offset < TILE_DATA_SIZE)
+        decode_tile_row(offset);
+}
+
+void PPU::decode_tile_row(usize offset)
+{
+    usize tile = offset >> 4;
+    usize row = (offset & 0x0f) >> 1;
+    u8 low = m_vram[offset & ~(usize)1];
+    u8 high = m_vram[offset | 1];
+
+    m_kernels->decode_row(low, high, m_tile_cache[tile][row]);
 }
 
 u8 PPU::read8OAM(u16 offset)
@@ -61,9 +149,29 @@ void PPU::write8OAM(u16 offset, u8 value)
 {
     assert(offset < OAM_SIZE);
 
+    if (m_oam[offset] == value)
+        return;
+    catch_up();
+    if ((offset & 0x03) == 0)
+        move_sprite_in_index(offset >> 2, m_oam[offset], value);
     m_oam[offset] = value;
 }
 
+// Sprites are indexed as if they were 16 lines high, gather_sprites drops
+// the extra lines in 8x8 mode.
+void PPU::move_sprite_in_index(usize sprite, u8 old_y_pos, u8 new_y_pos)
+{
+    u64 sprite_bit = (u64)1 << sprite;
+
+    i32 old_top = (i32)old_y_pos - 16;
+    for (i32 y = old_top < 0 ? 0 : old_top; y < old_top + 16 && y < 144; ++y)
+        m_line_sprites[y] &= ~sprite_bit;
+
+    i32 new_top = (i32)new_y_pos - 16;
+    for (i32 y = new_top < 0 ? 0 : new_top; y < new_top + 16 && y < 144; ++y)
+        m_line_sprites[y] |= sprite_bit;
+}
+
 void PPU::cycle()
 {
     ++m_dot_count;
@@ -73,26 +181,44 @@ void PPU::cycle()
                 if (oam_interrupt_enabled())
                     m_emulator.cpu().request_LCD_interrupt();
 
+                if (m_pixel_y == 0)
+                    start_frame();
                 gather_sprites();
             }
 
-            if (m_dot_count == 80) {
+            if (m_dot_count == OAM_DOTS) {
                 m_dot_count = 0;
                 m_was_window = false;
+                m_rendered_x = 0;
                 m_mode = ModeFlag::TRANSFER;
+                if (m_accurate)
+                    start_transfer();
             }
             break;
 
         case ModeFlag::TRANSFER:
-            render_pixel();
-            ++m_pixel_x;
-            if (m_dot_count == 160) {
-                m_dot_count = 0;
-                m_mode = ModeFlag::HBLANK;
-                m_pixel_x = 0;
-                if (m_was_window)
-                    ++m_window_line;
+            if (m_accurate) {
+                step_fifo();
+                if (m_pixel_x < 160)
+                    break;
+            } else {
+                if (m_dot_count > FETCH_DELAY)
+                    ++m_pixel_x;
+                if (m_dot_count < FAST_TRANSFER_DOTS)
+                    break;
+
+                if (m_skipping)
+                    m_was_window = window_on_line();
+                else
+                    render_scanline(m_rendered_x, 160);
             }
+
+            m_transfer_dots = m_dot_count;
+            m_dot_count = 0;
+            m_mode = ModeFlag::HBLANK;
+            m_pixel_x = 0;
+            if (m_was_window)
+                ++m_window_line;
             break;
 
         case ModeFlag::HBLANK:
@@ -101,7 +227,7 @@ void PPU::cycle()
                     m_emulator.cpu().request_LCD_interrupt();
             }
 
-            if (m_dot_count == 208) {
+            if (m_dot_count == LINE_DOTS - OAM_DOTS - m_transfer_dots) {
                 m_dot_count = 0;
                 set_line_y(m_pixel_y + 1);
                 m_mode = (m_pixel_y == 144) ? ModeFlag::VBLANK : ModeFlag::OAM;
@@ -113,15 +239,21 @@ void PPU::cycle()
                 if (vblank_interrupt_enabled())
                     m_emulator.cpu().request_LCD_interrupt();
 
-                copy_pixels();
+                m_frame_unchanged = m_skipping;
+                if (m_skipping) {
+                    m_skipping = false;
+                    m_sink->repeat_frame();
+                } else {
+                    end_frame();
+                }
                 m_emulator.cpu().request_vblank_interrupt();
                 m_emulator.notify_frame_end();
             }
 
-            if (m_dot_count % 456 == 0) {
+            if (m_dot_count % LINE_DOTS == 0) {
                 set_line_y(m_pixel_y + 1);
             }
-            if (m_dot_count == 4560) {
+            if (m_dot_count == 10 * LINE_DOTS) {
                 m_dot_count = 0;
                 set_line_y(0);
                 m_window_line = 0;
@@ -156,151 +288,308 @@ u8 PPU::TileData::color_at(usize x, usize y)
     return (low ? 1 : 0) | (high ? 2 : 0);
 }
 
-u8 PPU::background_color_at(u8 x, u8 y)
+void PPU::render_scanline(usize from, usize to)
 {
-    auto tile_x = x >> 3;
-    auto tile_y = y >> 3;
-    auto tile_offset = tile_x + tile_y * 32;
-    u8 tile_index = m_vram[bg_tilemap_base() + tile_offset];
-
-    if (tiled_data_signed_addressing())
-        tile_index += 128;
+    assert(from < to && to <= 160);
+    m_rendered_x = to;
 
-    auto* data = bg_tile_data(tile_index);
-    auto color_index = data->color_at(x % 8, y % 8);
-    return color_index;
-}
+    if (!m_in_frame)
+        begin_frame();
+    if (!m_frame.pixels)
+        return;
+    u32* colors = m_frame.line(m_pixel_y);
 
-u8 PPU::window_color_at(u8 x, u8 y)
-{
-    auto tile_x = x >> 3;
-    auto tile_y = y >> 3;
-    auto tile_offset = tile_x + tile_y * 32;
-    u8 tile_index = m_vram[window_tilemap_base() + tile_offset];
+    if (m_emulator.cpu().stopped() || !display_enabled()) {
+        for (usize x = from; x < to; ++x)
+            colors[x] = texture_color(0);
+        return;
+    }
 
-    if (tiled_data_signed_addressing())
-        tile_index += 128;
+    u8 bg_indices[160];
 
-    auto* data = bg_tile_data(tile_index);
-    auto color_index = data->color_at(x % 8, y % 8);
-    return color_index;
-}
+    if (bg_display_enabled()) {
+        usize window_start = to;
+        if (window_display_enabled() && (i32)m_pixel_y >= (i32)m_window_y) {
+            i32 window_left = (i32)m_window_x - 7;
+            window_start = window_left < (i32)from ? from : (usize)window_left;
+            if (window_start > to)
+                window_start = to;
+        }
 
-bool PPU::inside_window(u8 x, u8 y)
-{
-    return ((i32)x >= ((i32)m_window_x - 7) && (i32)y >= (i32)m_window_y);
-}
+        render_background(from, window_start, bg_indices);
+        if (window_start < to) {
+            m_was_window = true;
+            render_window(window_start, to, bg_indices);
+        }
 
-void PPU::render_pixel()
-{
-    if (m_emulator.cpu().stopped()) {
-        set_pixel(m_pixel_x, m_pixel_y, 0);
-        return;
+        m_kernels->map_palette(
+                bg_indices + from,
+                m_bg_colors,
+                colors + from,
+                to - from);
+    } else {
+        for (usize x = from; x < to; ++x) {
+            bg_indices[x] = 0;
+            colors[x] = texture_color(0);
+        }
     }
 
-    u8 bg_color_index = 0;
-    u8 color = 0;
-
-    if (!display_enabled()) {
-        set_pixel(m_pixel_x, m_pixel_y, color);
-        return;
+    if (sprite_display_enabled()) {
+        u32 sprite_colors[160];
+        u8 sprite_flags[160];
+        render_sprites(from, to, sprite_colors, sprite_flags);
+        m_kernels->compose(
+                bg_indices + from,
+                sprite_colors + from,
+                sprite_flags + from,
+                colors + from,
+                to - from);
     }
+}
 
-    if (bg_display_enabled()) {
-        if (window_display_enabled() && inside_window(m_pixel_x, m_pixel_y)) {
-            m_was_window = true;
-            bg_color_index = window_color_at(
-                    m_pixel_x + 7 - m_window_x,
-                    m_window_line
-                    );
-            color = bg_palette()->color_for(bg_color_index);
-        } else {
-            bg_color_index = background_color_at(
-                    m_pixel_x + m_scroll_x,
-                    m_pixel_y + m_scroll_y
-                    );
-            color = bg_palette()->color_for(bg_color_index);
-        }
+// Tile rows come from the decoded tile cache, one lookup per 8 pixels.
+void PPU::render_background(usize from, usize to, u8* color_indices)
+{
+    u8 y = m_pixel_y + m_scroll_y;
+    usize tilemap_row = bg_tilemap_base() + (y >> 3) * 32;
+
+    usize x = from;
+    while (x < to) {
+        u8 bg_x = x + m_scroll_x;
+        u8 tile_index = m_vram[tilemap_row + (bg_x >> 3)];
+        if (tiled_data_signed_addressing())
+            tile_index += 128;
+
+        auto* row = bg_tile_row(tile_index, y % 8);
+        for (usize fine_x = bg_x % 8; fine_x < 8 && x < to; ++fine_x, ++x)
+            color_indices[x] = row[fine_x];
     }
+}
 
-    if (!sprite_display_enabled()) {
-        set_pixel(m_pixel_x, m_pixel_y, color);
-        return;
+void PPU::render_window(usize from, usize to, u8* color_indices)
+{
+    u8 y = m_window_line;
+    usize tilemap_row = window_tilemap_base() + (y >> 3) * 32;
+
+    usize x = from;
+    while (x < to) {
+        u8 window_x = x + 7 - m_window_x;
+        u8 tile_index = m_vram[tilemap_row + (window_x >> 3)];
+        if (tiled_data_signed_addressing())
+            tile_index += 128;
+
+        auto* row = bg_tile_row(tile_index, y % 8);
+        for (usize fine_x = window_x % 8; fine_x < 8 && x < to; ++fine_x, ++x)
+            color_indices[x] = row[fine_x];
     }
+}
+
+void PPU::render_sprites(
+        usize from,
+        usize to,
+        u32* sprite_colors,
+        u8* sprite_flags)
+{
+    // the first sprite (by X) with an opaque pixel owns that pixel
+    std::memset(sprite_flags + from, SpritePixel::NONE, to - from);
 
-    // Sprites
     for (usize index = 0; index < m_scanline_sprite_count; ++index) {
         auto* sprite = m_scanline_sprites[index];
 
-        if ((i32)m_pixel_x < sprite->x() || (i32)m_pixel_x >= (sprite->x() + 8))
+        i32 start = sprite->x() < (i32)from ? (i32)from : sprite->x();
+        i32 end = sprite->x() + 8 > (i32)to ? (i32)to : sprite->x() + 8;
+        if (start >= end)
             continue;
 
-        auto coord_x = m_pixel_x - sprite->x();
-        auto coord_y = m_pixel_y - sprite->y();
+        u8 pixels[8];
+        sprite_row(*sprite, pixels);
+
+        auto* palette = m_obj_colors[sprite->palette_number() ? 1 : 0];
 
-        if (sprite->x_flip())
-            coord_x = 7 - coord_x;
+        for (i32 x = start; x < end; ++x) {
+            if (sprite_flags[x] != SpritePixel::NONE)
+                continue;
 
-        if (sprite->y_flip())
-            coord_y = sprite_height() - coord_y - 1;
+            auto color_index = pixels[x - sprite->x()];
+            if (color_index == 0)
+                continue;
 
-        auto sprite_tile_index = sprite->tile_index;
-        if (sprite_double_height()) {
-            sprite_tile_index = (sprite_tile_index & 0xfe) | (coord_y >> 3);
+            sprite_colors[x] = palette[color_index];
+            sprite_flags[x] = sprite->behind_bg()
+                ? SpritePixel::BEHIND_BG
+                : SpritePixel::FRONT;
         }
+    }
+}
 
-        auto* sprite_tile_data = obj_tile_data(sprite_tile_index);
-        auto color_index = sprite_tile_data->color_at(coord_x, coord_y & 0x07);
+// The sprite's color indices on the current line, leftmost first
+void PPU::sprite_row(const Sprite& sprite, u8* pixels) const
+{
+    usize coord_y = m_pixel_y - sprite.y();
+    if (sprite.y_flip())
+        coord_y = sprite_height() - coord_y - 1;
 
-        if (color_index == 0)
-            continue;
+    auto sprite_tile_index = sprite.tile_index;
+    if (sprite_double_height()) {
+        sprite_tile_index = (sprite_tile_index & 0xfe) | (coord_y >> 3);
+    }
 
-        auto* palette = obj_palette(sprite->palette_number());
+    // an x-flipped row is the cached row with its bytes reversed
+    u64 row;
+    std::memcpy(&row, obj_tile_row(sprite_tile_index, coord_y & 0x07), 8);
+    if (sprite.x_flip())
+        row = __builtin_bswap64(row);
+    std::memcpy(pixels, &row, 8);
+}
 
-        if (bg_color_index == 0) {
-            color = palette->color_for(color_index);
-        } else if (!sprite->behind_bg() || color_index == 0) {
-            color = palette->color_for(color_index);
-        }
-        break;
-    }
+void PPU::start_transfer()
+{
+    m_fifo = {};
+    m_fifo.bg_pos = 8;
+    m_fifo.first_fetch = true;
+    m_fifo.discard = m_scroll_x & 0x07;
 
-    set_pixel(m_pixel_x, m_pixel_y, color);
+    if (!m_in_frame)
+        begin_frame();
 }
 
-void PPU::set_pixel(usize x, usize y, u8 color)
+// One dot of the accurate renderer. Registers are read as the fetcher and
+// the mixer get to them, so writes take effect at the exact pixel.
+void PPU::step_fifo()
 {
-    auto index = (x + y * 160) * 3;
+    auto& fifo = m_fifo;
+
+    // a sprite stops the pixel output while it is fetched, once the
+    // background fetcher has a tile ready
+    if (!fifo.fetching_sprite && fifo.discard == 0 && sprite_display_enabled()
+            && fifo.next_sprite < m_scanline_sprite_count
+            && m_scanline_sprites[fifo.next_sprite]->x() <= (i32)m_pixel_x)
+        fifo.fetching_sprite = true;
+
+    if (fifo.fetching_sprite) {
+        if (fifo.fetch_dots < TILE_FETCH_DOTS || fifo.bg_pos == 8) {
+            step_fetcher();
+        } else if (++fifo.sprite_dots == SPRITE_FETCH_DOTS) {
+            fetch_sprite();
+            fifo.fetching_sprite = false;
+            fifo.sprite_dots = 0;
+            ++fifo.next_sprite;
+        }
+        return;
+    }
 
-    assert(index < PIXEL_BUFFER_SIZE);
+    // the window restarts the fetcher on its first tile
+    if (!fifo.fetch_window && bg_display_enabled() && window_display_enabled()
+            && (i32)m_pixel_y >= (i32)m_window_y
+            && (i32)m_pixel_x >= (i32)m_window_x - 7) {
+        fifo.fetch_window = true;
+        fifo.fetch_x = 0;
+        fifo.fetch_dots = 0;
+        fifo.first_fetch = false;
+        fifo.bg_pos = 8;
+        fifo.discard = m_window_x < 7 ? 7 - m_window_x : 0;
+        m_was_window = true;
+    }
+
+    if (fifo.bg_pos < 8) {
+        u8 bg_index = fifo.bg[fifo.bg_pos++];
+        if (fifo.discard > 0)
+            --fifo.discard;
+        else
+            output_pixel(bg_index);
+    }
 
-    m_pixels[index + 0] = COLORS[color][0];
-    m_pixels[index + 1] = COLORS[color][1];
-    m_pixels[index + 2] = COLORS[color][2];
+    step_fetcher();
 }
 
-void PPU::copy_pixels()
+void PPU::step_fetcher()
 {
-    u8* pixels { nullptr };
-    int pitch;
-    if (SDL_LockTexture(m_screen, NULL, (void**)&pixels, &pitch) != 0)
-    {
-        fprintf(stderr, "could not lock texture: %s\n", SDL_GetError());
-        exit(-1);
+    auto& fifo = m_fifo;
+
+    if (fifo.fetch_dots < TILE_FETCH_DOTS) {
+        ++fifo.fetch_dots;
+        if (fifo.fetch_dots == 2) {
+            usize tile_address;
+            if (fifo.fetch_window) {
+                tile_address = window_tilemap_base()
+                    + (m_window_line >> 3) * 32
+                    + (fifo.fetch_x & 0x1f);
+            } else {
+                u8 y = m_pixel_y + m_scroll_y;
+                tile_address = bg_tilemap_base()
+                    + (y >> 3) * 32
+                    + (((m_scroll_x >> 3) + fifo.fetch_x) & 0x1f);
+            }
+            fifo.fetch_tile = m_vram[tile_address];
+        } else if (fifo.fetch_dots == TILE_FETCH_DOTS) {
+            u8 tile_index = fifo.fetch_tile;
+            if (tiled_data_signed_addressing())
+                tile_index += 128;
+            u8 row = fifo.fetch_window
+                ? m_window_line
+                : (u8)(m_pixel_y + m_scroll_y);
+            std::memcpy(fifo.fetched, bg_tile_row(tile_index, row & 0x07), 8);
+        }
     }
 
-    for (usize y = 0; y < 144; ++y) {
-        for (usize x = 0; x < 160; ++x) {
-            usize texture_index = x * 4 + y * pitch;
-            usize pixel_index = (x + y * 160) * 3;
-
-            pixels[texture_index + 0] = m_pixels[pixel_index + 0];
-            pixels[texture_index + 1] = m_pixels[pixel_index + 1];
-            pixels[texture_index + 2] = m_pixels[pixel_index + 2];
+    if (fifo.fetch_dots == TILE_FETCH_DOTS && fifo.bg_pos == 8) {
+        fifo.fetch_dots = 0;
+        if (fifo.first_fetch) {
+            fifo.first_fetch = false;
+            return;
         }
+        std::memcpy(fifo.bg, fifo.fetched, 8);
+        fifo.bg_pos = 0;
+        ++fifo.fetch_x;
     }
+}
+
+// Sprite pixels only go where the sprite FIFO is still transparent, the
+// sprites being fetched by X this keeps the leftmost one on top.
+void PPU::fetch_sprite()
+{
+    auto& fifo = m_fifo;
+    auto* sprite = m_scanline_sprites[fifo.next_sprite];
+
+    u8 pixels[8];
+    sprite_row(*sprite, pixels);
+
+    for (i32 index = 0; index < 8; ++index) {
+        i32 slot = sprite->x() + index - (i32)m_pixel_x;
+        if (slot < 0 || pixels[index] == 0)
+            continue;
 
-    SDL_UnlockTexture(m_screen);
+        usize position = (fifo.obj_head + slot) & 0x07;
+        if (fifo.obj_colors[position] != 0)
+            continue;
+        fifo.obj_colors[position] = pixels[index];
+        fifo.obj_attributes[position] = sprite->attributes;
+    }
+}
+
+void PPU::output_pixel(u8 bg_index)
+{
+    auto& fifo = m_fifo;
+    u8 obj_color = fifo.obj_colors[fifo.obj_head];
+    u8 obj_attributes = fifo.obj_attributes[fifo.obj_head];
+    fifo.obj_colors[fifo.obj_head] = 0;
+    fifo.obj_head = (fifo.obj_head + 1) & 0x07;
+
+    bool blank = m_emulator.cpu().stopped() || !display_enabled();
+    u32 color = texture_color(0);
+    if (!blank && bg_display_enabled())
+        color = m_bg_colors[bg_index];
+    else
+        bg_index = 0;
+
+    bool behind_bg = obj_attributes & 0x80;
+    if (!blank && obj_color != 0 && sprite_display_enabled()
+            && (!behind_bg || bg_index == 0))
+        color = m_obj_colors[(obj_attributes & 0x10) ? 1 : 0][obj_color];
+
+    if (m_frame.pixels)
+        m_frame.line(m_pixel_y)[m_pixel_x] = color;
+    ++m_pixel_x;
 }
 
 void PPU::gather_sprites()
@@ -308,11 +597,12 @@ void PPU::gather_sprites()
     auto* sprites = reinterpret_cast<Sprite*>(m_oam);
     m_scanline_sprite_count = 0;
 
-    for (usize index = 0; index < 40; ++index) {
-        auto* sprite = &sprites[index];
+    // candidates in OAM order, the first 10 on the line are kept
+    u64 candidates = m_pixel_y < 144 ? m_line_sprites[m_pixel_y] : 0;
+    for (; candidates; candidates &= candidates - 1) {
+        auto* sprite = &sprites[__builtin_ctzll(candidates)];
 
-        if ((i32)m_pixel_y >= sprite->y()
-         && (i32)m_pixel_y < (sprite->y() + (i32)sprite_height())) {
+        if ((i32)m_pixel_y < (sprite->y() + (i32)sprite_height())) {
 
             // Insertion sort
             usize reverse_index = m_scanline_sprite_count;
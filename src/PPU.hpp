@@ -2,21 +2,27 @@
 
 #include <cassert>
 
-#include <SDL2/SDL.h>
-
 #include "Defs.hpp"
+#include "FrameSink.hpp"
+#include "PixelKernels.hpp"
 
 namespace GB {
 
 static const usize VRAM_SIZE = 8 * KB;
 static const usize OAM_SIZE = 0xa0;
+static const usize TILE_COUNT = 384;
+static const usize TILE_DATA_SIZE = TILE_COUNT * 16;
+
+// The renderer used when none is set, e.g. -DPPU_RENDER_POLICY=FAST
+#ifndef PPU_RENDER_POLICY
+#define PPU_RENDER_POLICY AUTO
+#endif
 
 class Emulator;
 
 class PPU {
     public:
-        explicit PPU(Emulator&, SDL_Texture*);
-        ~PPU();
+        explicit PPU(Emulator&, FrameSink*);
 
         u8 read8(u32);
         void write8(u32, u8);
@@ -25,6 +31,31 @@ class PPU {
 
         void cycle();
 
+        struct RenderPolicy {
+            enum Policy {
+                // Whole lines at once, mode 3 always lasts 172 dots
+                FAST,
+                // A pixel FIFO stepped every dot, mode 3 lasts longer with
+                // fine scrolling, the window and sprites
+                ACCURATE,
+                // FAST, and ACCURATE for the frame after one where the
+                // picture changed in the middle of a line
+                AUTO,
+            };
+        };
+
+        // Takes effect at the next frame
+        inline void set_render_policy(RenderPolicy::Policy policy) { m_policy = policy; }
+        inline RenderPolicy::Policy render_policy() const { return m_policy; }
+        // The current frame is drawn by the pixel FIFO
+        inline bool accurate_frame() const { return m_accurate; }
+
+        // The last completed frame was identical to the one before and was
+        // not drawn again.
+        inline bool frame_unchanged() const { return m_frame_unchanged; }
+        // For state outside the PPU that affects the picture (CPU stop)
+        inline void notify_picture_change() { catch_up(); }
+
         struct ModeFlag {
             enum Flag {
                 HBLANK = 0,
@@ -45,29 +76,80 @@ class PPU {
                 | (m_pixel_y == m_ly_compare ? 0x04 : 0);
             return value & read_mask;
         }
-        inline void set_control(u8 value) { m_control_reg = value; }
+        inline void set_control(u8 value)
+        {
+            if (value == m_control_reg)
+                return;
+            catch_up();
+            m_control_reg = value;
+        }
         inline void set_status(u8 value)
         {
             static const u8 write_mask = 0x7c;
             m_status_reg = value & write_mask;
         }
-        inline void set_scroll_x(u8 value) { m_scroll_x = value; }
+        inline void set_scroll_x(u8 value)
+        {
+            if (value == m_scroll_x)
+                return;
+            catch_up();
+            m_scroll_x = value;
+        }
         inline u8 scroll_x_reg() const { return m_scroll_x; }
-        inline void set_scroll_y(u8 value) { m_scroll_y = value; }
+        inline void set_scroll_y(u8 value)
+        {
+            if (value == m_scroll_y)
+                return;
+            catch_up();
+            m_scroll_y = value;
+        }
         inline u8 scroll_y_reg() const { return m_scroll_y; }
         inline u8 window_x() const { return m_window_x; }
         inline u8 window_y() const { return m_window_y; }
-        inline void set_window_x(u8 value) { m_window_x = value; }
-        inline void set_window_y(u8 value) { m_window_y = value; }
+        inline void set_window_x(u8 value)
+        {
+            if (value == m_window_x)
+                return;
+            catch_up();
+            m_window_x = value;
+        }
+        inline void set_window_y(u8 value)
+        {
+            if (value == m_window_y)
+                return;
+            catch_up();
+            m_window_y = value;
+        }
         inline u8 ly_compare() const { return m_ly_compare; }
         inline void set_ly_compare(u8 value) { m_ly_compare = value; }
 
         inline u8 bg_palette_reg() const { return m_bg_palette; }
-        inline void set_bg_palette(u8 value) { m_bg_palette = value; }
+        inline void set_bg_palette(u8 value)
+        {
+            if (value == m_bg_palette)
+                return;
+            catch_up();
+            m_bg_palette = value;
+            build_palette_lut(value, m_bg_colors);
+        }
         inline u8 obj_palette0_reg() const { return m_object_palette0; }
-        inline void set_object_palette0(u8 value) { m_object_palette0 = value; }
+        inline void set_object_palette0(u8 value)
+        {
+            if (value == m_object_palette0)
+                return;
+            catch_up();
+            m_object_palette0 = value;
+            build_palette_lut(value, m_obj_colors[0]);
+        }
         inline u8 obj_palette1_reg() const { return m_object_palette1; }
-        inline void set_object_palette1(u8 value) { m_object_palette1 = value; }
+        inline void set_object_palette1(u8 value)
+        {
+            if (value == m_object_palette1)
+                return;
+            catch_up();
+            m_object_palette1 = value;
+            build_palette_lut(value, m_obj_colors[1]);
+        }
 
         inline bool display_enabled() const { return m_control_reg & 0x80; }
         inline bool window_display_enabled() const { return m_control_reg & 0x20; }
@@ -134,6 +216,18 @@ class PPU {
             return reinterpret_cast<TileData*>(raw_ptr);
         }
 
+        // Rows of the decoded tile cache: one color index per byte, pixel 0
+        // first.
+        inline const u8* bg_tile_row(u8 tile_index, usize row) const
+        {
+            usize tile = tile_data_base() / 16 + tile_index;
+            return m_tile_cache[tile][row];
+        }
+        inline const u8* obj_tile_row(u8 tile_index, usize row) const
+        {
+            return m_tile_cache[tile_index][row];
+        }
+
         struct Palette {
             u8 data;
 
@@ -173,38 +267,124 @@ class PPU {
         static_assert(sizeof(Sprite) == 4, "PPU::Sprite is not 4 bytes wide");
 
     private:
+        static const usize LINE_DOTS = 456;
+        static const usize OAM_DOTS = 80;
+        static const usize FAST_TRANSFER_DOTS = 172;
+        // dots before the first pixel when nothing delays it
+        static const usize FETCH_DELAY = 12;
+        static const usize TILE_FETCH_DOTS = 6;
+        static const usize SPRITE_FETCH_DOTS = 6;
+
+        // State of the accurate renderer during TRANSFER. The background
+        // FIFO is only refilled once empty; the sprite FIFO is a ring of the
+        // next 8 pixels, starting at obj_head.
+        struct PixelFifo {
+            u8 bg[8];
+            usize bg_pos;
+            u8 obj_colors[8];
+            u8 obj_attributes[8];
+            usize obj_head;
+            // the tile being fetched, one fetch takes TILE_FETCH_DOTS
+            usize fetch_dots;
+            usize fetch_x;
+            u8 fetch_tile;
+            bool fetch_window;
+            // the first fetch of a line is thrown away
+            bool first_fetch;
+            u8 fetched[8];
+            // pixels dropped for fine scrolling
+            usize discard;
+            // next of the line's sprites, by X
+            usize next_sprite;
+            bool fetching_sprite;
+            usize sprite_dots;
+        };
+
         Emulator& m_emulator;
-        SDL_Texture* m_screen { nullptr };
-        u8* m_vram { nullptr };
-        u8* m_oam { nullptr };
+        FrameSink* m_sink { nullptr };
+        const PixelKernels* m_kernels { &pixel_kernels() };
+        u8 m_vram[VRAM_SIZE] {};
+        u8 m_oam[OAM_SIZE] {};
+        alignas(8) u8 m_tile_cache[TILE_COUNT][8][8] {};
         ModeFlag::Flag m_mode { ModeFlag::OAM };
         usize m_dot_count { 0 };
         usize m_pixel_x { 0 };
         usize m_pixel_y { 0 };
+        usize m_rendered_x { 0 };
         usize m_window_line { 0 };
         bool m_was_window { false };
         u8 m_scroll_x { 0 };
         u8 m_scroll_y { 0 };
         u8 m_window_x { 0 };
         u8 m_window_y { 0 };
-        u8* m_pixels { nullptr };
+        // The frame being rendered, empty when the sink wants no pixels
+        FrameSpan m_frame {};
+        bool m_in_frame { false };
+        // Anything the picture depends on changed since the frame started.
+        // A frame that starts with nothing changed during the previous one
+        // is skipped, unless something changes before it ends.
+        bool m_dirty { true };
+        bool m_skipping { false };
+        bool m_frame_unchanged { false };
+        RenderPolicy::Policy m_policy { RenderPolicy::PPU_RENDER_POLICY };
+        bool m_accurate { false };
+        // something changed during TRANSFER in the current frame
+        bool m_mid_line_write { false };
+        usize m_transfer_dots { FAST_TRANSFER_DOTS };
+        PixelFifo m_fifo {};
+        // bit n of entry y is set when sprite n can be on line y
+        u64 m_line_sprites[144] {};
         usize m_scanline_sprite_count { 0 };
         Sprite* m_scanline_sprites[10];
 
         u8 m_bg_palette { 0 };
         u8 m_object_palette0 { 0 };
         u8 m_object_palette1 { 0 };
+        // Palettes resolved to texture pixels, rebuilt when they are written
+        alignas(16) u32 m_bg_colors[4];
+        alignas(16) u32 m_obj_colors[2][4];
 
         u8 m_control_reg { 0x91 };
         u8 m_status_reg { 0 };
         u8 m_ly_compare { 0 };
 
-        u8 background_color_at(u8, u8);
-        u8 window_color_at(u8, u8);
-        bool inside_window(u8, u8);
-        void render_pixel();
-        void set_pixel(usize, usize, u8);
-        void copy_pixels();
+        // The fast renderer draws lines in one go at the end of TRANSFER. A
+        // write that changes the picture mid-line first renders the pixels
+        // the LCD already went past, so the output matches a per-dot
+        // renderer. Called before every change to what the PPU draws.
+        inline void catch_up()
+        {
+            m_dirty = true;
+            if (m_mode == ModeFlag::TRANSFER)
+                m_mid_line_write = true;
+            if (m_skipping)
+                resume_rendering();
+            else if (!m_accurate && m_mode == ModeFlag::TRANSFER
+                    && m_rendered_x < m_pixel_x)
+                render_scanline(m_rendered_x, m_pixel_x);
+        }
+        void resume_rendering();
+        bool window_on_line() const;
+        void render_scanline(usize from, usize to);
+        void render_background(usize from, usize to, u8* color_indices);
+        void render_window(usize from, usize to, u8* color_indices);
+        void render_sprites(
+                usize from,
+                usize to,
+                u32* sprite_colors,
+                u8* sprite_flags);
+        void sprite_row(const Sprite&, u8* pixels) const;
+        void start_transfer();
+        void step_fifo();
+        void step_fetcher();
+        void fetch_sprite();
+        void output_pixel(u8 bg_index);
+        void decode_tile_row(usize offset);
+        static void build_palette_lut(u8 palette, u32* lut);
+        void start_frame();
+        void begin_frame();
+        void end_frame();
+        void move_sprite_in_index(usize sprite, u8 old_y_pos, u8 new_y_pos);
         void gather_sprites();
 };
 
@@ -0,0 +1,198 @@
+#include "PixelKernels.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIXEL_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+namespace GB {
+
+static void decode_row_scalar(u8 low, u8 high, u8* indices)
+{
+    for (usize x = 0; x < 8; ++x) {
+        usize bit_offset = 7 - x;
+        indices[x] = ((low >> bit_offset) & 1) | (((high >> bit_offset) & 1) << 1);
+    }
+}
+
+static void map_palette_scalar(
+        const u8* indices,
+        const u32* lut,
+        u32* colors,
+        usize count)
+{
+    for (usize index = 0; index < count; ++index)
+        colors[index] = lut[indices[index]];
+}
+
+static void compose_scalar(
+        const u8* bg_indices,
+        const u32* sprite_colors,
+        const u8* sprite_flags,
+        u32* colors,
+        usize count)
+{
+    for (usize index = 0; index < count; ++index) {
+        auto flag = sprite_flags[index];
+        if (flag == SpritePixel::FRONT
+                || (flag == SpritePixel::BEHIND_BG && bg_indices[index] == 0))
+            colors[index] = sprite_colors[index];
+    }
+}
+
+#ifdef PIXEL_KERNELS_X86
+
+// pdep spreads each bitplane bit into its own byte
+__attribute__((target("bmi2")))
+static void decode_row_bmi2(u8 low, u8 high, u8* indices)
+{
+    static const u64 BYTE_LSBS = 0x0101010101010101;
+    u64 row = _pdep_u64(low, BYTE_LSBS) | (_pdep_u64(high, BYTE_LSBS) << 1);
+    // bit 7 is the leftmost pixel
+    row = __builtin_bswap64(row);
+    std::memcpy(indices, &row, 8);
+}
+
+// The 4 palette entries fit in one register: pshufb picks the 4 bytes of
+// entry i for every pixel, 4 pixels per shuffle.
+__attribute__((target("ssse3")))
+static void map_palette_ssse3(
+        const u8* indices,
+        const u32* lut,
+        u32* colors,
+        usize count)
+{
+    auto table = _mm_loadu_si128((const __m128i*)lut);
+    auto byte_offsets = _mm_setr_epi8(
+            0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3);
+    const __m128i spread[4] = {
+        _mm_setr_epi8(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3),
+        _mm_setr_epi8(4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7),
+        _mm_setr_epi8(8, 8, 8, 8, 9, 9, 9, 9, 10, 10, 10, 10, 11, 11, 11, 11),
+        _mm_setr_epi8(12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15),
+    };
+
+    usize index = 0;
+    for (; index + 16 <= count; index += 16) {
+        // indices are < 4, so the 16-bit shift never carries between bytes
+        auto pixels = _mm_loadu_si128((const __m128i*)(indices + index));
+        auto entry_offsets = _mm_slli_epi16(pixels, 2);
+        for (usize group = 0; group < 4; ++group) {
+            auto bytes = _mm_add_epi8(
+                    _mm_shuffle_epi8(entry_offsets, spread[group]),
+                    byte_offsets);
+            _mm_storeu_si128(
+                    (__m128i*)(colors + index + group * 4),
+                    _mm_shuffle_epi8(table, bytes));
+        }
+    }
+    map_palette_scalar(indices + index, lut, colors + index, count - index);
+}
+
+__attribute__((target("sse2")))
+static void compose_sse2(
+        const u8* bg_indices,
+        const u32* sprite_colors,
+        const u8* sprite_flags,
+        u32* colors,
+        usize count)
+{
+    auto front = _mm_set1_epi8(SpritePixel::FRONT);
+    auto behind = _mm_set1_epi8(SpritePixel::BEHIND_BG);
+    auto zero = _mm_setzero_si128();
+
+    usize index = 0;
+    for (; index + 16 <= count; index += 16) {
+        auto bg = _mm_loadu_si128((const __m128i*)(bg_indices + index));
+        auto flags = _mm_loadu_si128((const __m128i*)(sprite_flags + index));
+        auto use_sprite = _mm_or_si128(
+                _mm_cmpeq_epi8(flags, front),
+                _mm_and_si128(
+                    _mm_cmpeq_epi8(flags, behind),
+                    _mm_cmpeq_epi8(bg, zero)));
+
+        // widen the byte mask to one 32-bit lane per pixel
+        auto low_words = _mm_unpacklo_epi8(use_sprite, use_sprite);
+        auto high_words = _mm_unpackhi_epi8(use_sprite, use_sprite);
+        const __m128i masks[4] = {
+            _mm_unpacklo_epi16(low_words, low_words),
+            _mm_unpackhi_epi16(low_words, low_words),
+            _mm_unpacklo_epi16(high_words, high_words),
+            _mm_unpackhi_epi16(high_words, high_words),
+        };
+
+        for (usize group = 0; group < 4; ++group) {
+            auto* target = (__m128i*)(colors + index + group * 4);
+            auto sprite = _mm_loadu_si128(
+                    (const __m128i*)(sprite_colors + index + group * 4));
+            auto result = _mm_or_si128(
+                    _mm_and_si128(masks[group], sprite),
+                    _mm_andnot_si128(masks[group], _mm_loadu_si128(target)));
+            _mm_storeu_si128(target, result);
+        }
+    }
+    compose_scalar(
+            bg_indices + index,
+            sprite_colors + index,
+            sprite_flags + index,
+            colors + index,
+            count - index);
+}
+
+#endif
+
+static const PixelKernels SCALAR_KERNELS = {
+    "scalar",
+    decode_row_scalar,
+    map_palette_scalar,
+    compose_scalar,
+};
+
+static PixelKernels select_kernels()
+{
+    PixelKernels kernels = SCALAR_KERNELS;
+
+#ifdef PIXEL_KERNELS_X86
+    __builtin_cpu_init();
+    bool bmi2 = __builtin_cpu_supports("bmi2");
+    bool ssse3 = __builtin_cpu_supports("ssse3");
+    bool sse2 = __builtin_cpu_supports("sse2");
+
+    if (bmi2)
+        kernels.decode_row = decode_row_bmi2;
+    if (ssse3)
+        kernels.map_palette = map_palette_ssse3;
+    if (sse2)
+        kernels.compose = compose_sse2;
+
+    // every kernel in use, by its instruction set
+    static const char* NAMES[] = {
+        "scalar",
+        "bmi2",
+        "ssse3",
+        "bmi2+ssse3",
+        "sse2",
+        "bmi2+sse2",
+        "ssse3+sse2",
+        "bmi2+ssse3+sse2",
+    };
+    kernels.name = NAMES[bmi2 | ssse3 << 1 | sse2 << 2];
+#endif
+
+    return kernels;
+}
+
+const PixelKernels& pixel_kernels()
+{
+    static const PixelKernels kernels = select_kernels();
+    return kernels;
+}
+
+const PixelKernels& scalar_pixel_kernels()
+{
+    return SCALAR_KERNELS;
+}
+
+} // namespace GB
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Defs.hpp"
+
+namespace GB {
+
+// Per-pixel state of the sprite layer of a line
+struct SpritePixel {
+    enum Flag {
+        NONE = 0,
+        FRONT = 1,
+        BEHIND_BG = 2,
+    };
+};
+
+// Inner loops of the line renderer. The best implementation for the host
+// CPU is picked once at startup; the scalar one is always available.
+struct PixelKernels {
+    const char* name;
+
+    // Two bitplane bytes to 8 color indices, leftmost pixel first
+    void (*decode_row)(u8 low, u8 high, u8* indices);
+
+    // colors[i] = lut[indices[i]], lut being a resolved 4-entry palette
+    void (*map_palette)(
+            const u8* indices,
+            const u32* lut,
+            u32* colors,
+            usize count);
+
+    // Puts the sprite layer over the background colors, honouring the
+    // BG-over-OBJ priority against the background color indices
+    void (*compose)(
+            const u8* bg_indices,
+            const u32* sprite_colors,
+            const u8* sprite_flags,
+            u32* colors,
+            usize count);
+};
+
+const PixelKernels& pixel_kernels();
+const PixelKernels& scalar_pixel_kernels();
+
+} // namespace GB
@@ -0,0 +1,138 @@
+#include "SaveRam.hpp"
+#include "Log.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace GB {
+
+SaveRam::SaveRam(usize size, const SaveOptions& options)
+    : m_size(size)
+    , m_flush_interval_ms(options.flush_interval_ms)
+{
+    usize page_size = (usize)sysconf(_SC_PAGESIZE);
+    m_page_shift = __builtin_ctzl(page_size);
+
+    if (size == 0)
+        return;
+
+    // the dirty mask has one bit per page
+    assert(((size - 1) >> m_page_shift) < 64);
+
+    if (!options.path.empty() && map_file(options.path)) {
+        m_flusher = std::thread(&SaveRam::flusher_loop, this);
+        return;
+    }
+
+    m_data = (u8*)calloc(m_size, 1);
+    assert(m_data);
+}
+
+SaveRam::~SaveRam()
+{
+    if (!persistent()) {
+        free(m_data);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_flusher_mutex);
+        m_stopping = true;
+    }
+    m_flusher_wakeup.notify_one();
+    m_flusher.join();
+
+    flush();
+    munmap(m_data, m_mapped_size);
+    close(m_file_descriptor);
+}
+
+bool SaveRam::map_file(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        LOG_ERROR("could not open save file {}: {}", path, strerror(errno));
+        return false;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0
+            || ((usize)file_stat.st_size < m_size
+                && ftruncate(fd, m_size) != 0)) {
+        LOG_ERROR("could not size save file {}: {}", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    usize page_mask = ((usize)1 << m_page_shift) - 1;
+    m_mapped_size = (m_size + page_mask) & ~page_mask;
+
+    void* mapping = mmap(
+            nullptr,
+            m_mapped_size,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED,
+            fd,
+            0);
+    if (mapping == MAP_FAILED) {
+        LOG_ERROR("could not map save file {}: {}", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    // best effort: keep the pages resident so a write never faults to disk
+    mlock(mapping, m_mapped_size);
+
+    m_data = (u8*)mapping;
+    m_file_descriptor = fd;
+    printf("Save RAM mapped to %s\n", path.c_str());
+    return true;
+}
+
+void SaveRam::flush()
+{
+    if (!persistent())
+        return;
+
+    u64 dirty = m_dirty_pages.exchange(0, std::memory_order_relaxed);
+    usize page_size = (usize)1 << m_page_shift;
+
+    while (dirty) {
+        usize first = __builtin_ctzll(dirty);
+        usize last = first;
+        while (last + 1 < 64 && (dirty & ((u64)1 << (last + 1))))
+            ++last;
+        for (usize page = first; page <= last; ++page)
+            dirty &= ~((u64)1 << page);
+
+        usize offset = first * page_size;
+        usize length = (last - first + 1) * page_size;
+        if (offset + length > m_mapped_size)
+            length = m_mapped_size - offset;
+        if (msync(m_data + offset, length, MS_SYNC) != 0)
+            LOG_ERROR("could not sync save RAM: {}", strerror(errno));
+    }
+}
+
+void SaveRam::flusher_loop()
+{
+    std::unique_lock<std::mutex> lock(m_flusher_mutex);
+    while (!m_stopping) {
+        m_flusher_wakeup.wait_for(
+                lock,
+                std::chrono::milliseconds(m_flush_interval_ms));
+
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
+
+} // namespace GB
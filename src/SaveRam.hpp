@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "Defs.hpp"
+
+namespace GB {
+
+struct SaveOptions {
+    // where battery-backed cartridge RAM is persisted, empty to disable
+    std::string path {};
+    usize flush_interval_ms { 1000 };
+};
+
+// Cartridge RAM. When given a path, the memory is a shared mapping of that
+// file: writes land in the page cache directly and a background thread
+// msyncs the pages marked dirty every flush interval. The emulation thread
+// only ever sets a bit in the dirty mask.
+class SaveRam {
+    public:
+        SaveRam(usize size, const SaveOptions&);
+        ~SaveRam();
+
+        SaveRam(const SaveRam&) = delete;
+        SaveRam& operator=(const SaveRam&) = delete;
+
+        inline u8* data() { return m_data; }
+        inline usize size() const { return m_size; }
+        inline bool persistent() const { return m_file_descriptor >= 0; }
+
+        inline void mark_dirty(usize offset)
+        {
+            u64 page_bit = (u64)1 << (offset >> m_page_shift);
+            if (!(m_dirty_pages.load(std::memory_order_relaxed) & page_bit))
+                m_dirty_pages.fetch_or(page_bit, std::memory_order_relaxed);
+        }
+
+        void flush();
+
+    private:
+        u8* m_data { nullptr };
+        usize m_size { 0 };
+        usize m_mapped_size { 0 };
+        usize m_page_shift { 12 };
+        int m_file_descriptor { -1 };
+        std::atomic<u64> m_dirty_pages { 0 };
+
+        usize m_flush_interval_ms { 1000 };
+        bool m_stopping { false };
+        std::mutex m_flusher_mutex;
+        std::condition_variable m_flusher_wakeup;
+        std::thread m_flusher;
+
+        bool map_file(const std::string& path);
+        void flusher_loop();
+};
+
+} // namespace GB
@@ -0,0 +1,124 @@
+#include "SdlAudioSink.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace GB {
+
+void audio_callback(void*, u8*, int);
+
+// Stereo frames of the format, in bytes
+static usize frame_size(SampleFormat::Format format)
+{
+    return 2 * sample_size(format);
+}
+
+std::unique_ptr<SdlAudioSink> SdlAudioSink::open(
+        u32 sample_rate,
+        SampleFormat::Format format,
+        usize device_frames)
+{
+    std::unique_ptr<SdlAudioSink> sink(new SdlAudioSink());
+    sink->m_format = format;
+
+    SDL_AudioSpec desired_spec;
+    desired_spec.freq = sample_rate;
+    desired_spec.format = format == SampleFormat::F32 ? AUDIO_F32SYS : AUDIO_S16SYS;
+    desired_spec.channels = 2;
+    desired_spec.samples = device_frames;
+    desired_spec.callback = audio_callback;
+    desired_spec.userdata = (void*)sink.get();
+
+    sink->m_ring = std::make_unique<AudioRing>(
+            AUDIO_RING_FRAMES * frame_size(format),
+            frame_size(format));
+    sink->m_device_id = SDL_OpenAudioDevice(NULL, 0, &desired_spec, &sink->m_audio_spec, 0);
+    if (sink->m_device_id == 0)
+        return nullptr;
+
+    return sink;
+}
+
+SdlAudioSink::~SdlAudioSink()
+{
+    if (m_device_id)
+        SDL_CloseAudioDevice(m_device_id);
+}
+
+double SdlAudioSink::sample_rate() const
+{
+    return m_audio_spec.freq * (1.0 + m_rate_adjustment);
+}
+
+double SdlAudioSink::latency() const
+{
+    double frames = m_average_fill / frame_size(m_format) + m_audio_spec.samples;
+    return frames / m_audio_spec.freq;
+}
+
+void SdlAudioSink::write(const i16* samples, usize length)
+{
+    usize size = sample_size(m_format);
+    while (length) {
+        usize count = length < CONVERT_SAMPLES ? length : CONVERT_SAMPLES;
+        convert_samples(samples, count, m_format, m_converted);
+        m_ring->write(m_converted, count * size);
+        samples += count;
+        length -= count;
+    }
+    adjust_rate();
+}
+
+// The emulation runs off the host clock and the device off its own, so the
+// ring slowly fills or drains. Producing slightly more or fewer samples
+// per block steers it back to half full, too little to hear as pitch.
+void SdlAudioSink::adjust_rate()
+{
+    // the fill jumps by a whole device buffer on every callback
+    static const double SMOOTHING = 1.0 / 256.0;
+    m_average_fill += ((double)m_ring->fill() - m_average_fill) * SMOOTHING;
+
+    // the integral takes out the steady drift, over some seconds
+    static const double INTEGRAL_GAIN = 1.0 / 4096.0;
+    double target = m_ring->capacity() / 2.0;
+    double error = std::clamp((m_average_fill - target) / target, -1.0, 1.0);
+    m_error_integral = std::clamp(m_error_integral + error * INTEGRAL_GAIN, -1.0, 1.0);
+    m_rate_adjustment = -std::clamp(error + m_error_integral, -1.0, 1.0) * MAX_RATE_ADJUSTMENT;
+}
+
+void SdlAudioSink::pause()
+{
+    SDL_PauseAudioDevice(m_device_id, true);
+}
+
+void SdlAudioSink::unpause()
+{
+    SDL_PauseAudioDevice(m_device_id, false);
+}
+
+void SdlAudioSink::set_buffer_depth(usize frames)
+{
+    auto ring = std::make_unique<AudioRing>(
+            frames * frame_size(m_format),
+            frame_size(m_format));
+    SDL_LockAudioDevice(m_device_id);
+    std::swap(m_ring, ring);
+    SDL_UnlockAudioDevice(m_device_id);
+    m_average_fill = 0.0;
+    m_error_integral = 0.0;
+}
+
+// On the audio thread
+void SdlAudioSink::callback(u8* audio_stream, int length)
+{
+    m_ring->read(audio_stream, length, m_audio_spec.silence);
+    m_callbacks.fetch_add(1, std::memory_order_relaxed);
+}
+
+void audio_callback(void* sink, u8* audio_stream, int stream_length)
+{
+    reinterpret_cast<SdlAudioSink*>(sink)
+        ->callback(audio_stream, stream_length);
+}
+
+} // namespace GB
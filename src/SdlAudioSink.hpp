@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <SDL2/SDL.h>
+
+#include "AudioRing.hpp"
+#include "AudioSink.hpp"
+
+namespace GB {
+
+// stereo frames per device callback
+static const usize AUDIO_SAMPLES_COUNT = 1024;
+// stereo frames buffered between the emulation and the audio device
+static const usize AUDIO_RING_FRAMES = 4 * AUDIO_SAMPLES_COUNT;
+// the low latency profile, under 10 ms at 44.1 kHz and up: the ring is
+// held around 256 frames and the device takes 128 at a time
+static const usize LOW_LATENCY_SAMPLES_COUNT = 128;
+static const usize LOW_LATENCY_RING_FRAMES = 512;
+// how far the sample rate may stray from the device's to keep the ring
+// half full
+static const double MAX_RATE_ADJUSTMENT = 0.005;
+
+// Plays through an SDL audio device. Samples wait in a ring for the
+// device callback, and the sample rate asked of the APU is nudged to keep
+// the ring half full.
+class SdlAudioSink : public AudioSink {
+    public:
+        // nullptr when no device could be opened, see SDL_GetError()
+        static std::unique_ptr<SdlAudioSink> open(
+                u32 sample_rate,
+                SampleFormat::Format,
+                usize device_frames);
+        ~SdlAudioSink();
+
+        SdlAudioSink(const SdlAudioSink&) = delete;
+        SdlAudioSink& operator=(const SdlAudioSink&) = delete;
+
+        double sample_rate() const override;
+        void write(const i16* samples, usize length) override;
+
+        void pause() override;
+        void unpause() override;
+
+        // Replaces the ring, to be called while paused
+        void set_buffer_depth(usize frames);
+        // what the device accepted
+        inline u32 device_rate() const { return m_audio_spec.freq; }
+        inline usize device_frames() const { return m_audio_spec.samples; }
+        // seconds from a sample leaving the APU to the device playing it,
+        // on average: the ring fill plus a device buffer
+        double latency() const;
+
+        inline u64 callbacks() const { return m_callbacks.load(std::memory_order_relaxed); }
+        // audio callbacks that found the ring short of samples
+        inline u64 underruns() const { return m_ring->underruns(); }
+        // chunks that did not fit in the ring, in part or whole
+        inline u64 overruns() const { return m_ring->overruns(); }
+        // current deviation of the sample rate from the device's, as a
+        // fraction
+        inline double rate_adjustment() const { return m_rate_adjustment; }
+
+        void callback(u8*, int);
+
+    private:
+        // samples are converted to the device format this many at a time
+        static const usize CONVERT_SAMPLES = 512;
+
+        SdlAudioSink() = default;
+
+        SDL_AudioDeviceID m_device_id { 0 };
+        SDL_AudioSpec m_audio_spec;
+        SampleFormat::Format m_format { SampleFormat::S16 };
+        std::unique_ptr<AudioRing> m_ring;
+        std::atomic<u64> m_callbacks { 0 };
+        alignas(16) u8 m_converted[CONVERT_SAMPLES * sizeof(float)];
+
+        // ring fill in bytes, smoothed over the device callbacks
+        double m_average_fill { 0.0 };
+        double m_error_integral { 0.0 };
+        double m_rate_adjustment { 0.0 };
+
+        void adjust_rate();
+};
+
+} // namespace GB
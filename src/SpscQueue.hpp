@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+
+#include "Defs.hpp"
+
+namespace GB {
+
+// Bounded wait-free queue for exactly one producer thread and one consumer
+// thread. push fails when the queue is full, pop when it is empty.
+template <typename T, usize CAPACITY>
+class SpscQueue {
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0,
+            "SpscQueue capacity must be a power of two");
+
+    public:
+        bool push(const T& item)
+        {
+            usize tail = m_tail.load(std::memory_order_relaxed);
+            if (tail - m_head.load(std::memory_order_acquire) == CAPACITY)
+                return false;
+
+            m_items[tail & (CAPACITY - 1)] = item;
+            m_tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool pop(T& item)
+        {
+            usize head = m_head.load(std::memory_order_relaxed);
+            if (head == m_tail.load(std::memory_order_acquire))
+                return false;
+
+            item = m_items[head & (CAPACITY - 1)];
+            m_head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        // each index is only written by one side, keep them on their own
+        // cache lines
+        alignas(64) std::atomic<usize> m_head { 0 };
+        alignas(64) std::atomic<usize> m_tail { 0 };
+        T m_items[CAPACITY];
+};
+
+} // namespace GB
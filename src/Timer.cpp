@@ -31,11 +31,19 @@ u16 Timer::clock_select_mask() const
     }
 }
 
+// the APU frame sequencer runs off this divider bit, at 512 Hz
+static const u16 FRAME_SEQUENCER_BIT = 1 << 12;
+
 void Timer::set_divider_internal(u16 value)
 {
     bool timer_inc_bit = timer_trigger_bit();
+    bool sequencer_bit = m_divider & FRAME_SEQUENCER_BIT;
     m_divider = value;
     bool new_timer_inc_bit = timer_trigger_bit();
+
+    // resetting DIV can clock the sequencer early
+    if (sequencer_bit && !(m_divider & FRAME_SEQUENCER_BIT))
+        m_emulator.apu().step_frame_sequencer();
     bool timer_inc_bit_changed = timer_inc_bit && !new_timer_inc_bit;
 
     if (timer_enabled() && timer_inc_bit_changed) {
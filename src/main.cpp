@@ -1,87 +1,396 @@
+#include <atomic>
+#include <cassert>
+#include <chrono>
 #include <cstdio>
+#include <memory>
 #include <optional>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "SDL.h"
 
+#include "AudioSink.hpp"
 #include "Cart.hpp"
 #include "Emulator.hpp"
+#include "FrameSink.hpp"
+#include "Gbs.hpp"
 #include "Joypad.hpp"
+#include "Log.hpp"
+#include "SdlAudioSink.hpp"
+#include "SpscQueue.hpp"
 
-u8* load_file(const char* filename)
+std::string save_path_for(const char* rom_filename)
 {
-    auto file = fopen(filename, "rb");
-    if (!file) {
-        perror(filename);
-        exit(-1);
-    }
+    std::string path(rom_filename);
+    auto extension = path.find_last_of('.');
+    auto directory = path.find_last_of('/');
+    if (extension != std::string::npos
+            && (directory == std::string::npos || extension > directory))
+        path.erase(extension);
+    return path + ".sav";
+}
 
-    fseek(file, 0, SEEK_END);
-    auto size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+struct AudioOptions {
+    // no device nor file, the APU only keeps its registers up to date
+    bool enabled { true };
+    // write to this file instead of the device
+    const char* path { nullptr };
+    u32 sample_rate { 44100 };
+    GB::SampleFormat::Format format { GB::SampleFormat::S16 };
+    // device ring and device buffer, in stereo frames
+    usize depth { GB::AUDIO_RING_FRAMES };
+    usize device_frames { GB::AUDIO_SAMPLES_COUNT };
+    // the emulation runs each frame in this many slices, handing the
+    // samples over in bursts small enough for a shallow ring
+    u32 slices { 1 };
+};
 
-    auto* data = (u8*)malloc(size);
-    if (!fread(data, size, 1, file)) {
-        perror(filename);
-        fclose(file);
-        exit(-1);
-    }
+bool has_extension(const char* path, const char* extension)
+{
+    std::string name(path);
+    usize length = strlen(extension);
+    return name.size() >= length
+        && name.compare(name.size() - length, length, extension) == 0;
+}
+
+// A WAV file when the path says so, raw samples otherwise
+std::unique_ptr<GB::FileAudioSink> open_audio_file(const AudioOptions& options)
+{
+    auto container = GB::FileAudioSink::Format::RAW;
+    if (has_extension(options.path, ".wav"))
+        container = GB::FileAudioSink::Format::WAV;
+    return std::make_unique<GB::FileAudioSink>(
+            options.path,
+            container,
+            options.format,
+            options.sample_rate);
+}
+
+// Input goes from the SDL thread to the emulation thread through a queue,
+// the emulator is only ever touched by the latter.
+struct InputEvent {
+    enum Kind {
+        BUTTON,
+        RUN,
+        PAUSE,
+        STEP,
+        PRINT_JOYPAD,
+        TOGGLE_MUTE,
+    };
+
+    Kind kind;
+    GB::Joypad::Buttons::Button button;
+    bool pressed;
+};
+
+typedef GB::SpscQueue<InputEvent, 256> InputQueue;
+
+// frames are 70224 dots of the 4.194304 MHz clock
+static const u64 FRAME_CYCLES = 70224;
+static const std::chrono::nanoseconds FRAME_PERIOD {
+    FRAME_CYCLES * 1000000000ull / 4194304ull
+};
+// slices of about 2 ms, one APU block each
+static const u32 LOW_LATENCY_SLICES = 8;
 
-    return data;
+void queue_input(InputQueue& input, const InputEvent& event)
+{
+    if (!input.push(event))
+        LOG_WARNING("input queue full, dropping event");
 }
 
-void handle_keypress(GB::Emulator& emulator, SDL_KeyboardEvent* event)
+void queue_keypress(InputQueue& input, SDL_KeyboardEvent* event)
 {
     bool pressed = event->type == SDL_KEYDOWN;
+    GB::Joypad::Buttons::Button button;
     switch (event->keysym.sym) {
         case SDLK_w:
-            emulator
-                .joypad()
-                .set_button_status(GB::Joypad::Buttons::UP, pressed);
+            button = GB::Joypad::Buttons::UP;
             break;
         case SDLK_s:
-            emulator
-                .joypad()
-                .set_button_status(GB::Joypad::Buttons::DOWN, pressed);
+            button = GB::Joypad::Buttons::DOWN;
             break;
         case SDLK_a:
-            emulator
-                .joypad()
-                .set_button_status(GB::Joypad::Buttons::LEFT, pressed);
+            button = GB::Joypad::Buttons::LEFT;
             break;
         case SDLK_d:
-            emulator
-                .joypad()
-                .set_button_status(GB::Joypad::Buttons::RIGHT, pressed);
+            button = GB::Joypad::Buttons::RIGHT;
             break;
         case SDLK_j:
-            emulator
-                .joypad()
-                .set_button_status(GB::Joypad::Buttons::B, pressed);
+            button = GB::Joypad::Buttons::B;
             break;
         case SDLK_k:
-            emulator
-                .joypad()
-                .set_button_status(GB::Joypad::Buttons::A, pressed);
+            button = GB::Joypad::Buttons::A;
             break;
         case SDLK_t:
-            emulator
-                .joypad()
-                .set_button_status(GB::Joypad::Buttons::SELECT, pressed);
+            button = GB::Joypad::Buttons::SELECT;
             break;
         case SDLK_y:
-            emulator
-                .joypad()
-                .set_button_status(GB::Joypad::Buttons::START, pressed);
+            button = GB::Joypad::Buttons::START;
             break;
+        default:
+            if (!pressed)
+                return;
+            switch (event->keysym.sym) {
+                case SDLK_n:
+                    queue_input(input, { InputEvent::STEP, {}, true });
+                    break;
+                case SDLK_c:
+                    queue_input(input, { InputEvent::RUN, {}, true });
+                    break;
+                case SDLK_x:
+                    queue_input(input, { InputEvent::PAUSE, {}, true });
+                    break;
+                case SDLK_b:
+                    queue_input(input, { InputEvent::PRINT_JOYPAD, {}, true });
+                    break;
+                case SDLK_m:
+                    queue_input(input, { InputEvent::TOGGLE_MUTE, {}, true });
+                    break;
+            }
+            return;
+    }
+
+    queue_input(input, { InputEvent::BUTTON, button, pressed });
+}
+
+void apply_input(GB::Emulator& emulator, const InputEvent& event, bool& run)
+{
+    switch (event.kind) {
+        case InputEvent::BUTTON:
+            emulator.joypad().set_button_status(event.button, event.pressed);
+            break;
+        case InputEvent::RUN:
+            run = true;
+            emulator.apu().unpause();
+            break;
+        case InputEvent::PAUSE:
+            run = false;
+            emulator.apu().pause();
+            break;
+        case InputEvent::STEP:
+            emulator.step();
+            break;
+        case InputEvent::PRINT_JOYPAD:
+            printf("joypad=%02x\n", emulator.joypad().read_register());
+            break;
+        case InputEvent::TOGGLE_MUTE:
+            emulator.apu().set_muted(!emulator.apu().muted());
+            break;
+        default:
+            assert(false); // unreachable
+    }
+}
+
+// Moves the deadline one period on and sleeps until it. When too far
+// behind, after a stall, gives up on catching up.
+void wait_until_next(
+        std::chrono::steady_clock::time_point& deadline,
+        std::chrono::nanoseconds period)
+{
+    deadline += period;
+    auto now = std::chrono::steady_clock::now();
+    if (deadline + 4 * FRAME_PERIOD < now)
+        deadline = now;
+    else
+        std::this_thread::sleep_until(deadline);
+}
+
+// Runs on its own thread, paced by the host clock, publishing frames to the
+// sink as they complete. The audio device never holds it back.
+void emulation_loop(
+        GB::Emulator& emulator,
+        InputQueue& input,
+        const std::atomic<bool>& quit,
+        bool& run,
+        u32 slices)
+{
+    auto slice_period = FRAME_PERIOD / slices;
+    auto deadline = std::chrono::steady_clock::now();
+    while (!quit.load(std::memory_order_acquire)) {
+        InputEvent event;
+        while (input.pop(event))
+            apply_input(emulator, event, run);
+
+        if (!run) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            deadline = std::chrono::steady_clock::now();
+            continue;
+        }
+
+        if (slices == 1)
+            emulator.exec_to_next_frame();
+        else
+            emulator.exec_for(FRAME_CYCLES / slices);
+
+        wait_until_next(deadline, slice_period);
+    }
+}
+
+void install_breakpoints(
+        GB::Emulator& emulator,
+        const std::vector<std::pair<u16, u8>>& breakpoints,
+        bool& run)
+{
+    for (auto& [address, kinds] : breakpoints)
+        emulator.add_breakpoint(address, kinds);
+    emulator.set_breakpoint_callback([&](const GB::BreakpointHit& hit) {
+        const char* kind_name = "execute";
+        if (hit.kind == GB::AccessKind::READ)
+            kind_name = "read";
+        else if (hit.kind == GB::AccessKind::WRITE)
+            kind_name = "write";
+
+        printf(
+                "breakpoint: %s %#06x = %#04x at cycle %lu\n",
+                kind_name,
+                hit.address,
+                hit.value,
+                hit.cycle
+              );
+        emulator.cpu().dump_registers();
+        emulator.request_break();
+        emulator.apu().pause();
+        run = false;
+    });
+}
+
+// No window and no audio device: frames and samples go to files or
+// nowhere, as fast as possible.
+void run_headless(
+        GB::Cart& cart,
+        u64 frame_count,
+        const char* frames_path,
+        const AudioOptions& audio_options,
+        const std::vector<std::pair<u16, u8>>& breakpoints,
+        GB::PPU::RenderPolicy::Policy render_policy,
+        bool trace)
+{
+    std::unique_ptr<GB::FrameSink> sink;
+    if (frames_path)
+        sink = std::make_unique<GB::FileFrameSink>(frames_path);
+    else
+        sink = std::make_unique<GB::NullFrameSink>();
+
+    std::unique_ptr<GB::AudioSink> audio_sink;
+    if (audio_options.enabled && audio_options.path)
+        audio_sink = open_audio_file(audio_options);
+    else
+        audio_sink = std::make_unique<GB::NullAudioSink>();
+
+    GB::Emulator emulator(&cart, sink.get(), audio_sink.get());
+    emulator.ppu().set_render_policy(render_policy);
+    emulator.enable_tracing(trace);
+
+    bool run = true;
+    install_breakpoints(emulator, breakpoints, run);
+
+    emulator.apu().unpause();
+    for (u64 frame = 0; frame < frame_count && run; ++frame)
+        emulator.exec_to_next_frame();
+    emulator.apu().pause();
+}
+
+// Only the CPU and the APU run. Written to a file, or thrown away with
+// --no-audio, the song is rendered as fast as possible; on the device it
+// plays in real time until the length is reached.
+void run_gbs(
+        const char* filename,
+        u8 song,
+        u32 seconds,
+        const AudioOptions& audio_options)
+{
+    auto gbs = GB::GbsFile::load(filename);
+    if (!song)
+        song = gbs->first_song();
+    printf("%s - %s (%s)\n", gbs->title().c_str(), gbs->author().c_str(), gbs->copyright().c_str());
+    printf("song %d of %d, %u seconds\n", song, gbs->song_count(), seconds);
+
+    std::unique_ptr<GB::SdlAudioSink> device_sink;
+    std::unique_ptr<GB::AudioSink> audio_sink;
+    if (!audio_options.enabled) {
+        audio_sink = std::make_unique<GB::NullAudioSink>();
+    } else if (audio_options.path) {
+        audio_sink = open_audio_file(audio_options);
+    } else {
+        if (SDL_Init(SDL_INIT_AUDIO) < 0) {
+            fprintf(stderr, "Could not initialize SDL: %s\n", SDL_GetError());
+            exit(-1);
+        }
+        device_sink = GB::SdlAudioSink::open(
+                audio_options.sample_rate,
+                audio_options.format,
+                audio_options.device_frames);
+        if (!device_sink) {
+            fprintf(stderr, "Could not open audio device: %s\n", SDL_GetError());
+            exit(-1);
+        }
+        device_sink->set_buffer_depth(audio_options.depth);
+    }
+
+    GB::GbsPlayer player(*gbs, device_sink ? device_sink.get() : audio_sink.get());
+    player.start(song);
+    player.emulator().apu().unpause();
+
+    u64 frames = (u64)seconds * 4194304 / FRAME_CYCLES;
+    auto start = std::chrono::steady_clock::now();
+    if (device_sink) {
+        auto slice_period = FRAME_PERIOD / audio_options.slices;
+        auto deadline = start;
+        for (u64 slice = 0; slice < frames * audio_options.slices; ++slice) {
+            player.run_for(FRAME_CYCLES / audio_options.slices);
+            wait_until_next(deadline, slice_period);
+        }
+    } else {
+        for (u64 frame = 0; frame < frames; ++frame)
+            player.run_for(FRAME_CYCLES);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    player.emulator().apu().pause();
+
+    printf(
+            "rendered %u seconds in %.3f s, %.1fx real time\n",
+            seconds,
+            elapsed.count(),
+            seconds / elapsed.count()
+          );
+    if (device_sink) {
+        device_sink.reset();
+        SDL_Quit();
     }
 }
 
 [[noreturn]] void panic_usage(const char* argv0) {
-    fprintf(stderr, "Usage: %s OPTIONS <rom-file>\n", argv0);
+    fprintf(stderr, "Usage: %s OPTIONS <rom-file|gbs-file>\n", argv0);
     fprintf(stderr,
             "\n"
             "OPTIONS:\n"
             "\t--trace\ttrace the opcode execution\n"
+            "\t--log-ring\tkeep diagnostics in memory, print them on exit\n"
+            "\t--log-stats\tprint diagnostic counters on exit\n"
+            "\t--save-interval MS\tflush battery RAM every MS milliseconds\n"
+            "\t--break ADDR\tpause before executing the code at ADDR\n"
+            "\t--watch ADDR\tpause when ADDR is read or written\n"
+            "\t--headless FRAMES\trun FRAMES frames without a window\n"
+            "\t--frames PATH\twith --headless, write raw frames to PATH\n"
+            "\t--ppu fast|accurate|auto\tPPU renderer, auto switches to\n"
+            "\t\taccurate after frames changed mid-line\n"
+            "\t--audio-depth FRAMES\tbuffer FRAMES audio frames ahead of the\n"
+            "\t\tdevice\n"
+            "\t--no-audio\tneither play nor write any audio, the APU\n"
+            "\t\tdoes no more than keep its registers\n"
+            "\t--audio-out PATH\twrite the audio to PATH instead of the device,\n"
+            "\t\tas WAV when it ends in .wav, raw stereo samples otherwise\n"
+            "\t--audio-rate HZ\tsample rate, 8000 to 96000, 44100 by default\n"
+            "\t--audio-format s16|f32\t16-bit integer or float samples\n"
+            "\t--audio-buffer FRAMES\taudio device buffer, 1024 frames by\n"
+            "\t\tdefault\n"
+            "\t--song N\twith a .gbs file, play song N instead of the first\n"
+            "\t--length SECONDS\twith a .gbs file, stop after SECONDS, 180 by\n"
+            "\t\tdefault\n"
+            "\t--audio-latency low|normal\tlow aims under 10 ms: a 128 frame\n"
+            "\t\tdevice buffer and a 512 frame ring, fed every 2 ms\n"
            );
     exit(-1);
 }
@@ -89,10 +398,115 @@ void handle_keypress(GB::Emulator& emulator, SDL_KeyboardEvent* event)
 int main(int argc, char** argv) {
     std::optional<const char*> maybe_filename{};
     bool trace = false;
+    bool log_stats = false;
+    GB::SaveOptions save_options;
+    std::vector<std::pair<u16, u8>> breakpoints;
+    std::optional<u64> headless_frames {};
+    const char* frames_path = nullptr;
+    GB::PPU::RenderPolicy::Policy render_policy = GB::PPU::RenderPolicy::PPU_RENDER_POLICY;
+    AudioOptions audio_options;
+    bool low_latency = false;
+    bool depth_given = false;
+    bool device_frames_given = false;
+    u8 song = 0;
+    u32 song_seconds = 180;
 
     for (int argument_index = 1; argument_index < argc; ++argument_index) {
         if (!strcmp(argv[argument_index], "--trace")) {
             trace = true;
+        } else if (!strcmp(argv[argument_index], "--log-ring")) {
+            GB::Log::enable_ring(4096);
+        } else if (!strcmp(argv[argument_index], "--log-stats")) {
+            log_stats = true;
+        } else if (!strcmp(argv[argument_index], "--save-interval")) {
+            if (++argument_index >= argc)
+                panic_usage(argv[0]);
+            save_options.flush_interval_ms = strtoul(argv[argument_index], NULL, 10);
+            if (save_options.flush_interval_ms == 0)
+                panic_usage(argv[0]);
+        } else if (!strcmp(argv[argument_index], "--break")
+                || !strcmp(argv[argument_index], "--watch")) {
+            u8 kinds = !strcmp(argv[argument_index], "--break")
+                ? GB::AccessKind::EXECUTE
+                : GB::AccessKind::READ | GB::AccessKind::WRITE;
+            if (++argument_index >= argc)
+                panic_usage(argv[0]);
+            auto address = (u16)strtoul(argv[argument_index], NULL, 16);
+            breakpoints.push_back({ address, kinds });
+        } else if (!strcmp(argv[argument_index], "--headless")) {
+            if (++argument_index >= argc)
+                panic_usage(argv[0]);
+            headless_frames = strtoull(argv[argument_index], NULL, 10);
+        } else if (!strcmp(argv[argument_index], "--frames")) {
+            if (++argument_index >= argc)
+                panic_usage(argv[0]);
+            frames_path = argv[argument_index];
+        } else if (!strcmp(argv[argument_index], "--no-audio")) {
+            audio_options.enabled = false;
+        } else if (!strcmp(argv[argument_index], "--audio-out")) {
+            if (++argument_index >= argc)
+                panic_usage(argv[0]);
+            audio_options.path = argv[argument_index];
+        } else if (!strcmp(argv[argument_index], "--audio-depth")) {
+            if (++argument_index >= argc)
+                panic_usage(argv[0]);
+            audio_options.depth = strtoul(argv[argument_index], NULL, 10);
+            if (audio_options.depth == 0)
+                panic_usage(argv[0]);
+            depth_given = true;
+        } else if (!strcmp(argv[argument_index], "--song")) {
+            if (++argument_index >= argc)
+                panic_usage(argv[0]);
+            auto value = strtoul(argv[argument_index], NULL, 10);
+            if (value == 0 || value > 255)
+                panic_usage(argv[0]);
+            song = value;
+        } else if (!strcmp(argv[argument_index], "--length")) {
+            if (++argument_index >= argc)
+                panic_usage(argv[0]);
+            song_seconds = strtoul(argv[argument_index], NULL, 10);
+        } else if (!strcmp(argv[argument_index], "--audio-buffer")) {
+            if (++argument_index >= argc)
+                panic_usage(argv[0]);
+            audio_options.device_frames = strtoul(argv[argument_index], NULL, 10);
+            if (audio_options.device_frames == 0 || audio_options.device_frames > 8192)
+                panic_usage(argv[0]);
+            device_frames_given = true;
+        } else if (!strcmp(argv[argument_index], "--audio-latency")) {
+            if (++argument_index >= argc)
+                panic_usage(argv[0]);
+            if (!strcmp(argv[argument_index], "low"))
+                low_latency = true;
+            else if (!strcmp(argv[argument_index], "normal"))
+                low_latency = false;
+            else
+                panic_usage(argv[0]);
+        } else if (!strcmp(argv[argument_index], "--audio-rate")) {
+            if (++argument_index >= argc)
+                panic_usage(argv[0]);
+            audio_options.sample_rate = strtoul(argv[argument_index], NULL, 10);
+            if (audio_options.sample_rate < 8000 || audio_options.sample_rate > 96000)
+                panic_usage(argv[0]);
+        } else if (!strcmp(argv[argument_index], "--audio-format")) {
+            if (++argument_index >= argc)
+                panic_usage(argv[0]);
+            if (!strcmp(argv[argument_index], "s16"))
+                audio_options.format = GB::SampleFormat::S16;
+            else if (!strcmp(argv[argument_index], "f32"))
+                audio_options.format = GB::SampleFormat::F32;
+            else
+                panic_usage(argv[0]);
+        } else if (!strcmp(argv[argument_index], "--ppu")) {
+            if (++argument_index >= argc)
+                panic_usage(argv[0]);
+            if (!strcmp(argv[argument_index], "fast"))
+                render_policy = GB::PPU::RenderPolicy::FAST;
+            else if (!strcmp(argv[argument_index], "accurate"))
+                render_policy = GB::PPU::RenderPolicy::ACCURATE;
+            else if (!strcmp(argv[argument_index], "auto"))
+                render_policy = GB::PPU::RenderPolicy::AUTO;
+            else
+                panic_usage(argv[0]);
         } else {
             if (maybe_filename)
                 panic_usage(argv[0]);
@@ -103,8 +517,45 @@ int main(int argc, char** argv) {
     if (!maybe_filename)
         panic_usage(argv[0]);
 
+    // the profile only fills in what was not given explicitly
+    if (low_latency) {
+        if (!depth_given)
+            audio_options.depth = GB::LOW_LATENCY_RING_FRAMES;
+        if (!device_frames_given)
+            audio_options.device_frames = GB::LOW_LATENCY_SAMPLES_COUNT;
+        audio_options.slices = LOW_LATENCY_SLICES;
+    }
+
     auto filename = maybe_filename.value();
-    auto rom_data = load_file(filename);
+    if (has_extension(filename, ".gbs")) {
+        run_gbs(filename, song, song_seconds, audio_options);
+        GB::Log::dump_ring(stderr);
+        if (log_stats)
+            GB::Log::dump_counters(stderr);
+        return 0;
+    }
+
+    auto rom = GB::RomImage::load(filename);
+    save_options.path = save_path_for(filename);
+
+    if (headless_frames) {
+        {
+            GB::Cart cart(rom, save_options);
+            run_headless(
+                    cart,
+                    headless_frames.value(),
+                    frames_path,
+                    audio_options,
+                    breakpoints,
+                    render_policy,
+                    trace);
+        }
+
+        GB::Log::dump_ring(stderr);
+        if (log_stats)
+            GB::Log::dump_counters(stderr);
+        return 0;
+    }
 
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
         fprintf(stderr, "Could not initialize SDL: %s\n", SDL_GetError());
@@ -142,14 +593,50 @@ int main(int argc, char** argv) {
         exit(-1);
     }
 
-    GB::Cart cart(rom_data);
-    GB::Emulator emulator(&cart, texture);
+    // without an audio device, play on without sound
+    std::unique_ptr<GB::SdlAudioSink> device_sink;
+    std::unique_ptr<GB::AudioSink> audio_sink;
+    if (!audio_options.enabled) {
+        audio_sink = std::make_unique<GB::NullAudioSink>();
+    } else if (audio_options.path) {
+        audio_sink = open_audio_file(audio_options);
+    } else if ((device_sink = GB::SdlAudioSink::open(
+                    audio_options.sample_rate,
+                    audio_options.format,
+                    audio_options.device_frames))) {
+        device_sink->set_buffer_depth(audio_options.depth);
+    } else {
+        LOG_WARNING("could not open audio device: {}", SDL_GetError());
+        audio_sink = std::make_unique<GB::NullAudioSink>();
+    }
+
+    GB::Cart cart(rom, save_options);
+    GB::TripleBufferSink frame_sink;
+    GB::Emulator emulator(
+            &cart,
+            &frame_sink,
+            device_sink ? device_sink.get() : audio_sink.get());
+    emulator.ppu().set_render_policy(render_policy);
     emulator.enable_tracing(trace);
 
     SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
 
     bool run = false;
-    while (true) {
+
+    install_breakpoints(emulator, breakpoints, run);
+
+    InputQueue input;
+    std::atomic<bool> quit { false };
+    std::thread emulation_thread(
+            emulation_loop,
+            std::ref(emulator),
+            std::ref(input),
+            std::cref(quit),
+            std::ref(run),
+            audio_options.slices);
+
+    u64 presented_frames = 0;
+    while (!quit.load(std::memory_order_relaxed)) {
         auto start_millis = SDL_GetTicks();
 
         SDL_Event event;
@@ -157,38 +644,29 @@ int main(int argc, char** argv) {
             switch (event.type) {
                 case SDL_KEYDOWN:
                 case SDL_KEYUP:
-                    {
-                        auto* key_event = reinterpret_cast<SDL_KeyboardEvent*>(&event);
-                        handle_keypress(emulator, key_event);
-
-                        if (key_event->type == SDL_KEYDOWN) {
-                            if (key_event->keysym.sym == SDLK_n)
-                                emulator.step();
-                            if (key_event->keysym.sym == SDLK_c) {
-                                run = true;
-                                emulator.apu().unpause();
-                            }
-                            if (key_event->keysym.sym == SDLK_x) {
-                                run = false;
-                                emulator.apu().pause();
-                            }
-                            if (key_event->keysym.sym == SDLK_b) {
-                                printf(
-                                        "joypad=%02x\n",
-                                        emulator.joypad().read_register()
-                                      );
-                            }
-                        }
-                    }
+                    queue_keypress(
+                            input,
+                            reinterpret_cast<SDL_KeyboardEvent*>(&event));
                     break;
 
                 case SDL_QUIT:
-                    goto main_loop_exit;
+                    quit.store(true, std::memory_order_release);
+                    break;
             }
         }
 
-        if (run)
-            emulator.exec_to_next_frame();
+        // SDL textures may only be touched from this thread, so the frame
+        // is copied in once per present rather than drawn into a locked
+        // texture by the emulation thread
+        GB::FrameSpan frame;
+        if (frame_sink.acquire(frame)) {
+            SDL_UpdateTexture(
+                    texture,
+                    NULL,
+                    frame.pixels,
+                    frame.pitch * sizeof(u32));
+            ++presented_frames;
+        }
 
         SDL_RenderClear(renderer);
         SDL_RenderCopy(renderer, texture, NULL, NULL);
@@ -198,14 +676,42 @@ int main(int argc, char** argv) {
         if (delta_millis < 16)
             SDL_Delay(16 - delta_millis);
     }
-main_loop_exit:
+
+    emulation_thread.join();
+    emulator.apu().pause();
+
+    printf(
+            "frames: %lu presented, %lu dropped, %lu repeated\n",
+            presented_frames,
+            frame_sink.dropped_frames(),
+            frame_sink.repeated_frames()
+          );
+    if (device_sink) {
+        u64 callbacks = device_sink->callbacks();
+        printf(
+                "audio: %u Hz, %lu frame device buffer, %.1f ms latency\n",
+                device_sink->device_rate(),
+                device_sink->device_frames(),
+                device_sink->latency() * 1000.0
+              );
+        printf(
+                "audio: %lu underruns in %lu callbacks (%.2f%%), %lu overruns, rate %+.3f%%\n",
+                device_sink->underruns(),
+                callbacks,
+                callbacks ? device_sink->underruns() * 100.0 / callbacks : 0.0,
+                device_sink->overruns(),
+                device_sink->rate_adjustment() * 100.0
+              );
+    }
 
     SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
 
-    free(rom_data);
+    GB::Log::dump_ring(stderr);
+    if (log_stats)
+        GB::Log::dump_counters(stderr);
 
     return 0;
 }